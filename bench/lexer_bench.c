@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/tokenizer/token_run.h"
+#include "../src/tokenizer/tokenizer.h"
+#include "perf_counters.h"
+
+// Lexes one file `rounds` times with tokenizer_next, tokenizer_scan, tokenizer_run and
+// a TOKENIZER_DEFINE_RUN loop, reading the hardware counters around each one. Given the
+// path of lexer_cli (plus any options for it), also runs the whole CLI pipeline on the
+// file and counts the child processes. Everything is normalized per input byte and per
+// token.
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static char *read_file(const char *filename, long long *length) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *content = malloc(*length + 1);
+    if (!content || fread(content, 1, *length, file) != (size_t) *length) {
+        free(content);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    return content;
+}
+
+static unsigned long long lex_next(TokenizerContext *context, const char *content, const long long length,
+                                   const long long rounds) {
+    unsigned long long tokens = 0;
+
+    for (long long round = 0; round < rounds; round++) {
+        tokenizer_reset(context, content, length);
+
+        Token *token;
+        while ((token = tokenizer_next(context))) {
+            free(token->content);
+            free(token);
+            tokens++;
+        }
+    }
+
+    return tokens;
+}
+
+static unsigned long long lex_scan(TokenizerContext *context, const char *content, const long long length,
+                                   const long long rounds) {
+    unsigned long long tokens = 0;
+
+    for (long long round = 0; round < rounds; round++) {
+        tokenizer_reset(context, content, length);
+
+        TokenType type;
+        while (tokenizer_scan(context, &type)) {
+            tokens++;
+        }
+    }
+
+    return tokens;
+}
+
+// The push variants sum the token lengths per category so the handlers cannot be
+// optimized away.
+typedef struct {
+    unsigned long long tokens;
+    unsigned long long bytes[TOKEN_CATEGORY_ERROR + 1];
+} RunTotals;
+
+static inline bool count_token(void *user, const TokenType type, const TokenView view) {
+    RunTotals *totals = user;
+    totals->tokens++;
+    totals->bytes[token_category(type)] += view.length;
+    return true;
+}
+
+static bool count_callback(void *user, const TokenType type, const TokenView view) {
+    return count_token(user, type, view);
+}
+
+TOKENIZER_DEFINE_RUN(count_inline, count_token, count_token, count_token, count_token, count_token, count_token)
+
+static unsigned long long lex_run(TokenizerContext *context, const char *content, const long long length,
+                                  const long long rounds, const bool inlined) {
+    const TokenHandlers handlers = {
+        count_callback, count_callback, count_callback, count_callback, count_callback, count_callback
+    };
+    RunTotals totals = {0};
+
+    for (long long round = 0; round < rounds; round++) {
+        tokenizer_reset(context, content, length);
+        if (inlined) {
+            count_inline(context, &totals);
+        } else {
+            tokenizer_run(context, &handlers, &totals);
+        }
+    }
+
+    return totals.tokens;
+}
+
+// Runs `argv` with stdout discarded. The child blocks on a pipe until the counters are
+// attached, and they only start counting at its exec.
+static bool run_cli(char **argv, PerfSample *total) {
+    int ready[2];
+    if (pipe(ready) != 0) {
+        return false;
+    }
+
+    fflush(stdout);
+    const pid_t child = fork();
+    if (child < 0) {
+        close(ready[0]);
+        close(ready[1]);
+        return false;
+    }
+
+    if (child == 0) {
+        char go;
+        close(ready[1]);
+        if (read(ready[0], &go, 1) != 1) {
+            _exit(127);
+        }
+        close(ready[0]);
+
+        if (!freopen("/dev/null", "w", stdout)) {
+            _exit(127);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    close(ready[0]);
+
+    PerfCounters counters;
+    perf_counters_open(&counters, child, true);
+
+    const char go = 1;
+    const bool started = write(ready[1], &go, 1) == 1;
+    close(ready[1]);
+
+    int status = 0;
+    waitpid(child, &status, 0);
+
+    PerfSample sample;
+    perf_counters_read(&counters, &sample);
+    perf_counters_close(&counters);
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        total->values[i] += sample.values[i];
+        total->valid[i] = sample.valid[i];
+    }
+
+    return started && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void report(const char *mode, const long long length, const long long rounds, const unsigned long long tokens,
+                   const double elapsed, const PerfSample *sample) {
+    const double bytes = (double) length * (double) rounds;
+    printf("%-6s %9.1f MB/s  %7.2f ns/byte  %7.2f ns/token  %llu tokens\n", mode, bytes / elapsed / 1e6,
+           elapsed * 1e9 / bytes, tokens ? elapsed * 1e9 / (double) tokens : 0, tokens);
+    perf_counters_report(stdout, sample, bytes, tokens ? (double) tokens : 1);
+}
+
+int main(const int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file> [rounds] [<lexer_cli> [options...]]\n", argv[0]);
+        return 1;
+    }
+
+    long long length;
+    char *content = read_file(argv[1], &length);
+    if (!content) {
+        fprintf(stderr, "Failed to read '%s'\n", argv[1]);
+        return 1;
+    }
+
+    const long long rounds = argc > 2 ? atoll(argv[2]) : 20;
+    printf("%s: %lld bytes x %lld rounds, one core\n", argv[1], length, rounds);
+
+    TokenizerContext *context = tokenizer_init_string("", 0);
+    tokenizer_recover(context, true);
+
+    PerfCounters counters;
+    if (!perf_counters_open(&counters, 0, false)) {
+        fprintf(stderr, "Hardware counters unavailable (%s), reporting time only\n", strerror(counters.error));
+    }
+
+    // One untimed pass so the first loop doesn't pay for page faults and buffer growth.
+    const unsigned long long per_round = lex_scan(context, content, length, 1);
+
+    PerfSample sample;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    perf_counters_start(&counters);
+    unsigned long long tokens = lex_next(context, content, length, rounds);
+    perf_counters_stop(&counters, &sample);
+    report("next", length, rounds, tokens, seconds_since(&start), &sample);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    perf_counters_start(&counters);
+    tokens = lex_scan(context, content, length, rounds);
+    perf_counters_stop(&counters, &sample);
+    report("scan", length, rounds, tokens, seconds_since(&start), &sample);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    perf_counters_start(&counters);
+    tokens = lex_run(context, content, length, rounds, false);
+    perf_counters_stop(&counters, &sample);
+    report("run", length, rounds, tokens, seconds_since(&start), &sample);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    perf_counters_start(&counters);
+    tokens = lex_run(context, content, length, rounds, true);
+    perf_counters_stop(&counters, &sample);
+    report("inline", length, rounds, tokens, seconds_since(&start), &sample);
+
+    perf_counters_close(&counters);
+    tokenizer_free(context);
+
+    int status = 0;
+    if (argc > 3) {
+        // lexer_cli -i <file> -o /dev/null followed by the extra options.
+        char **command = malloc((argc + 4) * sizeof(char *));
+        int count = 0;
+        command[count++] = argv[3];
+        command[count++] = "-i";
+        command[count++] = argv[1];
+        command[count++] = "-o";
+        command[count++] = "/dev/null";
+        for (int i = 4; i < argc; i++) {
+            command[count++] = argv[i];
+        }
+        command[count] = NULL;
+
+        PerfSample total = {0};
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (long long round = 0; round < rounds && status == 0; round++) {
+            if (!run_cli(command, &total)) {
+                fprintf(stderr, "'%s' failed\n", argv[3]);
+                status = 1;
+            }
+        }
+
+        if (status == 0) {
+            report("cli", length, rounds, per_round * rounds, seconds_since(&start), &total);
+        }
+        free(command);
+    }
+
+    free(content);
+    return status;
+}
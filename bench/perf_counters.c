@@ -0,0 +1,128 @@
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char *counter_names[PERF_COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "branch-misses",
+    "L1D-misses",
+    "LLC-misses",
+};
+
+static void describe(const PerfCounter counter, struct perf_event_attr *attr) {
+    switch (counter) {
+        case PERF_CYCLES:
+            attr->type = PERF_TYPE_HARDWARE;
+            attr->config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PERF_INSTRUCTIONS:
+            attr->type = PERF_TYPE_HARDWARE;
+            attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PERF_BRANCH_MISSES:
+            attr->type = PERF_TYPE_HARDWARE;
+            attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case PERF_L1D_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_L1D
+                           | PERF_COUNT_HW_CACHE_OP_READ << 8
+                           | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+            break;
+        case PERF_LLC_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_LL
+                           | PERF_COUNT_HW_CACHE_OP_READ << 8
+                           | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+            break;
+        default:
+            break;
+    }
+}
+
+bool perf_counters_open(PerfCounters *counters, const pid_t pid, const bool on_exec) {
+    counters->available = 0;
+    counters->error = 0;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        describe((PerfCounter) i, &attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.inherit = on_exec;
+        attr.enable_on_exec = on_exec;
+
+        counters->fds[i] = (int) syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+        if (counters->fds[i] >= 0) {
+            counters->available++;
+        } else if (!counters->error) {
+            counters->error = errno;
+        }
+    }
+
+    return counters->available > 0;
+}
+
+void perf_counters_start(PerfCounters *counters) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (counters->fds[i] >= 0) {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void perf_counters_read(const PerfCounters *counters, PerfSample *sample) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        uint64_t values[3];
+        sample->valid[i] = counters->fds[i] >= 0
+                           && read(counters->fds[i], values, sizeof(values)) == sizeof(values)
+                           && values[2] > 0;
+        sample->values[i] = sample->valid[i] ? (double) values[0] * (double) values[1] / (double) values[2] : 0;
+    }
+}
+
+void perf_counters_stop(PerfCounters *counters, PerfSample *sample) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (counters->fds[i] >= 0) {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    perf_counters_read(counters, sample);
+}
+
+void perf_counters_report(FILE *file, const PerfSample *sample, const double bytes, const double tokens) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (sample->valid[i]) {
+            fprintf(file, "    %-14s %10.3f/byte %10.3f/token\n", counter_names[i], sample->values[i] / bytes,
+                    sample->values[i] / tokens);
+        }
+    }
+
+    if (sample->valid[PERF_CYCLES] && sample->valid[PERF_INSTRUCTIONS] && sample->values[PERF_CYCLES] > 0) {
+        fprintf(file, "    %-14s %10.2f\n", "IPC", sample->values[PERF_INSTRUCTIONS] / sample->values[PERF_CYCLES]);
+    }
+}
+
+void perf_counters_close(PerfCounters *counters) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (counters->fds[i] >= 0) {
+            close(counters->fds[i]);
+            counters->fds[i] = -1;
+        }
+    }
+
+    counters->available = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_COUNTER_COUNT
+} PerfCounter;
+
+// Hardware counters read through perf_event_open. Each one is opened on its own, so a
+// PMU that lacks one event (or a container that forbids them all) only blanks the
+// affected columns instead of failing the benchmark.
+typedef struct {
+    int fds[PERF_COUNTER_COUNT];
+    int available;
+    int error;
+} PerfCounters;
+
+typedef struct {
+    double values[PERF_COUNTER_COUNT];
+    bool valid[PERF_COUNTER_COUNT];
+} PerfSample;
+
+// Opens the counters stopped, for the calling thread (pid 0) or another process.
+// With `on_exec` they start by themselves when that process calls exec and also count
+// its children. Returns false when none could be opened, with the first errno in
+// counters->error; the other calls then do nothing and reports stay empty.
+bool perf_counters_open(PerfCounters *counters, pid_t pid, bool on_exec);
+
+void perf_counters_start(PerfCounters *counters);
+
+// Stops the counters and reads them, scaled up when the kernel had to multiplex.
+void perf_counters_stop(PerfCounters *counters, PerfSample *sample);
+
+// Reads without stopping, e.g. after a process counted with on_exec has exited.
+void perf_counters_read(const PerfCounters *counters, PerfSample *sample);
+
+// Prints one line per counter normalized per byte and per token, plus IPC.
+void perf_counters_report(FILE *file, const PerfSample *sample, double bytes, double tokens);
+
+void perf_counters_close(PerfCounters *counters);
+
+#endif //PERF_COUNTERS_H
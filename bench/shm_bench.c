@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/shm/token_ring.h"
+
+// Streams the tokens of one file through the shared-memory ring `iterations` times:
+// the parent lexes and produces, a forked child consumes. The same lexing without
+// the ring is timed first as the baseline.
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int consume(const char *name) {
+    TokenRing *ring = token_ring_open(name, 5000);
+    if (!ring) {
+        fprintf(stderr, "Failed to attach to shared memory ring\n");
+        return 1;
+    }
+
+    unsigned long long tokens = 0;
+    unsigned long long checksum = 0;
+    const CompactToken *records;
+    uint32_t count;
+
+    while ((count = token_ring_acquire(ring, &records)) > 0) {
+        for (uint32_t i = 0; i < count; i++) {
+            checksum += compact_token_type(&records[i]) + compact_token_length(&records[i]);
+        }
+
+        tokens += count;
+        token_ring_release(ring, count);
+    }
+
+    printf("consumer: %llu tokens (checksum %llx)\n", tokens, checksum);
+    fflush(stdout);
+    token_ring_close(ring);
+    return 0;
+}
+
+int main(const int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: shm_bench file [iterations] [capacity]\n");
+        return 1;
+    }
+
+    const int iterations = argc > 2 ? atoi(argv[2]) : 100;
+    const uint32_t capacity = argc > 3 ? (uint32_t) strtoul(argv[3], NULL, 10) : TOKEN_RING_DEFAULT_CAPACITY;
+
+    TokenizerContext *source = tokenizer_init(argv[1]);
+    if (!source) {
+        fprintf(stderr, "Failed to read input file\n");
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    unsigned long long tokens = 0;
+    for (int i = 0; i < iterations; i++) {
+        TokenizerContext *context = tokenizer_init_string(source->content, source->content_length);
+        TokenType type;
+        while (tokenizer_scan(context, &type)) {
+            tokens++;
+        }
+        tokenizer_free(context);
+    }
+
+    const double baseline = seconds_since(&start);
+
+    char name[64];
+    snprintf(name, sizeof(name), "/lexer-bench-%d", (int) getpid());
+
+    TokenRing *ring = token_ring_create(name, capacity, argv[1]);
+    if (!ring) {
+        fprintf(stderr, "Failed to create shared memory ring\n");
+        tokenizer_free(source);
+        return 1;
+    }
+
+    const pid_t child = fork();
+    if (child == 0) {
+        _exit(consume(name));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool lexed = child > 0;
+    for (int i = 0; lexed && i < iterations; i++) {
+        TokenizerContext *context = tokenizer_init_string(source->content, source->content_length);
+        lexed = token_ring_lex(ring, context);
+        tokenizer_free(context);
+    }
+    token_ring_finish(ring, !lexed);
+
+    int status = 1;
+    if (child > 0) {
+        waitpid(child, &status, 0);
+    }
+
+    const double elapsed = seconds_since(&start);
+    token_ring_close(ring);
+    token_ring_unlink(name);
+
+    const double megabytes = (double) source->content_length * iterations / (1024 * 1024);
+    printf("capacity %u, %d iterations of %lld bytes\n", capacity, iterations, source->content_length);
+    printf("lex only: %.3fs, %.0f tokens/s, %.1f MiB/s\n", baseline, tokens / baseline, megabytes / baseline);
+    printf("shm ring: %.3fs, %.0f tokens/s, %.1f MiB/s\n", elapsed, tokens / elapsed, megabytes / elapsed);
+
+    tokenizer_free(source);
+    return lexed && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
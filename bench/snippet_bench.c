@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/tokenizer/tokenizer.h"
+#include "perf_counters.h"
+
+// Lexes a set of short snippets over and over on one core, first with a fresh context
+// per snippet and then with a single context recycled through tokenizer_reset.
+// Snippets are the non-empty lines of the given file, or a built-in set.
+
+static const char *default_snippets[] = {
+    "1 + 2 * 3",
+    "let x = foo(bar, 42)",
+    "a.b.c[0] >= 0x1F && !done",
+    "\"hello\" + name + '!'",
+    "fn add(a: i32, b: i32) -> i32 { return a + b }",
+    "if (x < 10) { x += 1 } else { x = 0 }",
+    "3.14159f * r * r",
+    "list.map(it -> it * 2).filter(it -> it > 4)",
+};
+
+typedef struct {
+    char **items;
+    long long *lengths;
+    int count;
+} Snippets;
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static bool load_snippets(const char *filename, Snippets *snippets) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        return false;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+
+        snippets->items = realloc(snippets->items, (snippets->count + 1) * sizeof(char *));
+        snippets->lengths = realloc(snippets->lengths, (snippets->count + 1) * sizeof(long long));
+        snippets->items[snippets->count] = strdup(line);
+        snippets->lengths[snippets->count] = (long long) strlen(line);
+        snippets->count++;
+    }
+
+    fclose(file);
+    return snippets->count > 0;
+}
+
+static unsigned long long lex_fresh(const Snippets *snippets, const long long rounds) {
+    unsigned long long tokens = 0;
+
+    for (long long round = 0; round < rounds; round++) {
+        for (int i = 0; i < snippets->count; i++) {
+            error.message = NULL;
+            TokenizerContext *context = tokenizer_init_string(snippets->items[i], snippets->lengths[i]);
+            TokenType type;
+            while (tokenizer_scan(context, &type)) {
+                tokens++;
+            }
+            tokenizer_free(context);
+        }
+    }
+
+    return tokens;
+}
+
+static unsigned long long lex_reset(TokenizerContext *context, const Snippets *snippets, const long long rounds) {
+    unsigned long long tokens = 0;
+
+    for (long long round = 0; round < rounds; round++) {
+        for (int i = 0; i < snippets->count; i++) {
+            tokenizer_reset(context, snippets->items[i], snippets->lengths[i]);
+            TokenType type;
+            while (tokenizer_scan(context, &type)) {
+                tokens++;
+            }
+        }
+    }
+
+    return tokens;
+}
+
+static void report(const char *mode, const Snippets *snippets, const long long rounds, const unsigned long long tokens,
+                   const double elapsed, const PerfSample *sample) {
+    const double count = (double) snippets->count * (double) rounds;
+    printf("%-6s %12.0f snippets/s  %7.1f ns/snippet  %llu tokens\n", mode, count / elapsed, elapsed * 1e9 / count,
+           tokens);
+
+    double bytes = 0;
+    for (int i = 0; i < snippets->count; i++) {
+        bytes += (double) snippets->lengths[i];
+    }
+    perf_counters_report(stdout, sample, bytes * (double) rounds, tokens ? (double) tokens : 1);
+}
+
+int main(const int argc, char **argv) {
+    Snippets snippets = {(char **) default_snippets, NULL, sizeof(default_snippets) / sizeof(default_snippets[0])};
+    const long long rounds = argc > 2 ? atoll(argv[2]) : 200000;
+
+    if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        snippets = (Snippets) {NULL, NULL, 0};
+        if (!load_snippets(argv[1], &snippets)) {
+            fprintf(stderr, "Failed to read snippets from '%s'\n", argv[1]);
+            return 1;
+        }
+    } else {
+        snippets.lengths = malloc(snippets.count * sizeof(long long));
+        for (int i = 0; i < snippets.count; i++) {
+            snippets.lengths[i] = (long long) strlen(snippets.items[i]);
+        }
+    }
+
+    printf("%d snippets x %lld rounds, one core\n", snippets.count, rounds);
+
+    PerfCounters counters;
+    if (!perf_counters_open(&counters, 0, false)) {
+        fprintf(stderr, "Hardware counters unavailable (%s), reporting time only\n", strerror(counters.error));
+    }
+
+    PerfSample sample;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    perf_counters_start(&counters);
+    unsigned long long tokens = lex_fresh(&snippets, rounds);
+    perf_counters_stop(&counters, &sample);
+    report("fresh", &snippets, rounds, tokens, seconds_since(&start), &sample);
+
+    TokenizerContext *context = tokenizer_init_string("", 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    perf_counters_start(&counters);
+    tokens = lex_reset(context, &snippets, rounds);
+    perf_counters_stop(&counters, &sample);
+    report("reset", &snippets, rounds, tokens, seconds_since(&start), &sample);
+    tokenizer_free(context);
+    perf_counters_close(&counters);
+
+    return 0;
+}
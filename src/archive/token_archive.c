@@ -0,0 +1,746 @@
+#include "token_archive.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../io/byte_codec.h"
+#include "../tokenizer/token_run.h"
+
+#define ARCHIVE_HEADER_SIZE 40
+#define ARCHIVE_INDEX_RECORD_SIZE 24
+#define ARCHIVE_BLOCK_HEADER_SIZE 52
+
+// How a block stores the length of each token type, when it is not one fixed value.
+#define LENGTH_UNSEEN (-1)
+#define LENGTH_SIZED (-2)
+#define LENGTH_TEXT (-3)
+
+#define DIAGNOSTICS_RECOVER 1
+#define DIAGNOSTICS_BRACKETS 2
+#define DIAGNOSTICS_FAILED 4
+
+typedef enum {
+    SECTION_LENGTHS,
+    SECTION_TYPES,
+    SECTION_GAPS,
+    SECTION_SIZES,
+    SECTION_LINES,
+    SECTION_REFERENCES,
+    SECTION_DICTIONARY,
+    SECTION_COUNT
+} ArchiveSection;
+
+// Scratch space of the encoder, sized for one block and reused for every block.
+typedef struct {
+    unsigned char *sections[SECTION_COUNT];
+    size_t used[SECTION_COUNT];
+    size_t dictionary_capacity;
+    uint32_t *slots;
+    uint32_t slots_mask;
+    const char **texts;
+    uint32_t *text_lengths;
+    uint32_t texts_count;
+} ArchiveEncoder;
+
+static bool has_text(const TokenType type) {
+    const TokenCategory category = token_category(type);
+    return category != TOKEN_CATEGORY_OPERATOR && category != TOKEN_CATEGORY_KEYWORD;
+}
+
+// Hashes eight bytes at a time; identifiers are short, so this is most of the cost of
+// interning.
+static uint64_t hash_text(const char *text, uint32_t length) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ length;
+
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, text, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+        text += 8;
+        length -= 8;
+    }
+
+    // The tail is read as two overlapping words, or three single bytes when it is
+    // shorter than four, to avoid a variable-length copy.
+    uint64_t word = 0;
+    if (length >= 4) {
+        uint32_t low;
+        uint32_t high;
+        memcpy(&low, text, 4);
+        memcpy(&high, text + length - 4, 4);
+        word = (uint64_t) high << 32 | low;
+    } else if (length) {
+        word = (uint64_t) (unsigned char) text[0] << 16
+               | (uint64_t) (unsigned char) text[length >> 1] << 8
+               | (unsigned char) text[length - 1];
+    }
+    hash = (hash ^ word) * 0xC4CEB9FE1A85EC53ULL;
+    return hash ^ hash >> 29;
+}
+
+static bool encoder_init(ArchiveEncoder *encoder, const uint32_t block_tokens) {
+    memset(encoder, 0, sizeof(*encoder));
+
+    const size_t sizes[SECTION_COUNT] = {
+        [SECTION_LENGTHS] = TOKEN_TYPE_COUNT * VARINT_MAX_BYTES,
+        [SECTION_TYPES] = block_tokens,
+        [SECTION_GAPS] = (size_t) block_tokens * VARINT_MAX_BYTES,
+        [SECTION_SIZES] = (size_t) block_tokens * VARINT_MAX_BYTES,
+        [SECTION_LINES] = (size_t) block_tokens * 2 * VARINT_MAX_BYTES,
+        [SECTION_REFERENCES] = (size_t) block_tokens * VARINT_MAX_BYTES,
+        [SECTION_DICTIONARY] = 0,
+    };
+
+    bool allocated = true;
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        encoder->sections[i] = malloc(sizes[i] ? sizes[i] : 1);
+        allocated = allocated && encoder->sections[i];
+    }
+
+    uint32_t slots = 1;
+    while (slots < block_tokens * 2) {
+        slots <<= 1;
+    }
+    encoder->slots_mask = slots - 1;
+    encoder->slots = malloc(slots * sizeof(uint32_t));
+    encoder->texts = malloc(block_tokens * sizeof(const char *));
+    encoder->text_lengths = malloc(block_tokens * sizeof(uint32_t));
+
+    return allocated && encoder->slots && encoder->texts && encoder->text_lengths;
+}
+
+static void encoder_free(ArchiveEncoder *encoder) {
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        free(encoder->sections[i]);
+    }
+    free(encoder->slots);
+    free(encoder->texts);
+    free(encoder->text_lengths);
+}
+
+// Returns the dictionary entry of a text, adding it on first sight.
+static uint32_t encoder_intern(ArchiveEncoder *encoder, const char *text, const uint32_t length) {
+    uint32_t slot = (uint32_t) hash_text(text, length) & encoder->slots_mask;
+
+    while (encoder->slots[slot]) {
+        const uint32_t entry = encoder->slots[slot] - 1;
+        if (encoder->text_lengths[entry] == length && memcmp(encoder->texts[entry], text, length) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & encoder->slots_mask;
+    }
+
+    const uint32_t entry = encoder->texts_count++;
+    encoder->texts[entry] = text;
+    encoder->text_lengths[entry] = length;
+    encoder->slots[slot] = entry + 1;
+    return entry;
+}
+
+// Encodes tokens [first, first + count) into the encoder's sections. previous_end and
+// line carry the position of the token in front of the block and are advanced past it.
+static bool encode_block(ArchiveEncoder *encoder, const TokenTable *table, const char *content,
+                         const long long first, const uint32_t count, long long *previous_end, long long *line) {
+    const CompactToken *tokens = table->tokens + first;
+    const long long *starts = table->lines.starts;
+
+    long long fixed[TOKEN_TYPE_COUNT];
+    for (int type = 0; type < TOKEN_TYPE_COUNT; type++) {
+        fixed[type] = has_text((TokenType) type) ? LENGTH_TEXT : LENGTH_UNSEEN;
+    }
+
+    size_t text_bytes = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const TokenType type = compact_token_type(&tokens[i]);
+        const long long length = compact_token_length(&tokens[i]);
+        if (fixed[type] == LENGTH_TEXT) {
+            text_bytes += length;
+        } else if (fixed[type] == LENGTH_UNSEEN) {
+            fixed[type] = length;
+        } else if (fixed[type] != length) {
+            fixed[type] = LENGTH_SIZED;
+        }
+    }
+
+    const size_t dictionary_size = text_bytes + (size_t) count * VARINT_MAX_BYTES;
+    if (dictionary_size > encoder->dictionary_capacity) {
+        unsigned char *dictionary = realloc(encoder->sections[SECTION_DICTIONARY], dictionary_size);
+        if (!dictionary) {
+            return false;
+        }
+        encoder->sections[SECTION_DICTIONARY] = dictionary;
+        encoder->dictionary_capacity = dictionary_size;
+    }
+
+    unsigned char *lengths = encoder->sections[SECTION_LENGTHS];
+    for (int type = 0; type < TOKEN_TYPE_COUNT; type++) {
+        lengths = put_varint(lengths, fixed[type] >= 0 ? (uint64_t) fixed[type] + 1 : 0);
+    }
+
+    memset(encoder->slots, 0, (encoder->slots_mask + 1) * sizeof(uint32_t));
+    encoder->texts_count = 0;
+
+    unsigned char *types = encoder->sections[SECTION_TYPES];
+    unsigned char *gaps = encoder->sections[SECTION_GAPS];
+    unsigned char *sizes = encoder->sections[SECTION_SIZES];
+    unsigned char *lines = encoder->sections[SECTION_LINES];
+    unsigned char *references = encoder->sections[SECTION_REFERENCES];
+    long long end = *previous_end;
+    long long current = *line;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const TokenType type = compact_token_type(&tokens[i]);
+        const long long offset = compact_token_offset(&tokens[i]);
+        const long long length = compact_token_length(&tokens[i]);
+        if (offset < end) {
+            return false;
+        }
+
+        types[i] = (unsigned char) type;
+        gaps = put_varint(gaps, offset - end);
+
+        if (fixed[type] == LENGTH_TEXT) {
+            references = put_varint(references, encoder_intern(encoder, content + offset, (uint32_t) length));
+        } else if (fixed[type] < 0) {
+            sizes = put_varint(sizes, length);
+        }
+
+        long long next = current;
+        while (next < table->lines.count && starts[next] <= offset) {
+            next++;
+        }
+        lines = put_varint(lines, next - current);
+        if (next != current || i == 0) {
+            lines = put_varint(lines, offset - starts[next - 1] + 1);
+        }
+
+        current = next;
+        end = offset + length;
+    }
+
+    unsigned char *dictionary = encoder->sections[SECTION_DICTIONARY];
+    for (uint32_t i = 0; i < encoder->texts_count; i++) {
+        dictionary = put_varint(dictionary, encoder->text_lengths[i]);
+        memcpy(dictionary, encoder->texts[i], encoder->text_lengths[i]);
+        dictionary += encoder->text_lengths[i];
+    }
+
+    encoder->used[SECTION_LENGTHS] = lengths - encoder->sections[SECTION_LENGTHS];
+    encoder->used[SECTION_TYPES] = count;
+    encoder->used[SECTION_GAPS] = gaps - encoder->sections[SECTION_GAPS];
+    encoder->used[SECTION_SIZES] = sizes - encoder->sections[SECTION_SIZES];
+    encoder->used[SECTION_LINES] = lines - encoder->sections[SECTION_LINES];
+    encoder->used[SECTION_REFERENCES] = references - encoder->sections[SECTION_REFERENCES];
+    encoder->used[SECTION_DICTIONARY] = dictionary - encoder->sections[SECTION_DICTIONARY];
+
+    *previous_end = end;
+    *line = current;
+    return true;
+}
+
+static size_t error_size(const TokenizerError *diagnostic) {
+    return strlen(diagnostic->message) + 1 + 4 * VARINT_MAX_BYTES;
+}
+
+static unsigned char *put_error(unsigned char *bytes, const TokenizerError *diagnostic) {
+    const size_t length = strlen(diagnostic->message) + 1;
+    bytes = put_varint(bytes, length);
+    memcpy(bytes, diagnostic->message, length);
+    bytes += length;
+    bytes = put_varint(bytes, (uint64_t) diagnostic->frame.offset);
+    bytes = put_varint(bytes, (uint64_t) diagnostic->frame.line);
+    return put_varint(bytes, (uint64_t) diagnostic->frame.column);
+}
+
+// Serializes the diagnostics section, or returns NULL when out of memory.
+static unsigned char *encode_diagnostics(const TokenizerContext *context, size_t *size) {
+    const bool failed = !context->recover && error.message;
+
+    size_t capacity = 3 * VARINT_MAX_BYTES + (failed ? error_size(&error) : 0);
+    for (int i = 0; i < context->errors_count; i++) {
+        capacity += error_size(&context->errors[i]);
+    }
+
+    uint64_t pairs = 0;
+    for (long long i = 0; i < context->bracket_match_count; i++) {
+        pairs += context->bracket_match[i].match > context->bracket_match[i].index;
+    }
+    capacity += pairs * 2 * VARINT_MAX_BYTES;
+
+    unsigned char *diagnostics = malloc(capacity);
+    if (!diagnostics) {
+        return NULL;
+    }
+
+    const uint64_t flags = (context->recover ? DIAGNOSTICS_RECOVER : 0)
+                           | (context->brackets_mode ? DIAGNOSTICS_BRACKETS : 0)
+                           | (failed ? DIAGNOSTICS_FAILED : 0);
+    unsigned char *bytes = put_varint(diagnostics, flags);
+    bytes = put_varint(bytes, (uint64_t) context->errors_count);
+    for (int i = 0; i < context->errors_count; i++) {
+        bytes = put_error(bytes, &context->errors[i]);
+    }
+    if (failed) {
+        bytes = put_error(bytes, &error);
+    }
+
+    bytes = put_varint(bytes, pairs);
+    long long previous = 0;
+    for (long long i = 0; i < context->bracket_match_count; i++) {
+        const TokenizerBracketMatch *bracket = &context->bracket_match[i];
+        if (bracket->match > bracket->index) {
+            bytes = put_varint(bytes, (uint64_t) (bracket->index - previous));
+            bytes = put_varint(bytes, (uint64_t) (bracket->match - bracket->index));
+            previous = bracket->index;
+        }
+    }
+
+    *size = bytes - diagnostics;
+    return diagnostics;
+}
+
+static bool write_blocks(FILE *output, const TokenTable *table, const TokenizerContext *context,
+                         const uint32_t block_tokens) {
+    const uint32_t blocks = (uint32_t) ((table->count + block_tokens - 1) / block_tokens);
+    unsigned char *index = malloc(blocks ? (size_t) blocks * ARCHIVE_INDEX_RECORD_SIZE : 1);
+    ArchiveEncoder encoder;
+    bool written = index && encoder_init(&encoder, block_tokens);
+
+    unsigned char header[ARCHIVE_HEADER_SIZE] = {0};
+    written = written && fwrite(header, 1, sizeof(header), output) == sizeof(header);
+
+    uint64_t position = ARCHIVE_HEADER_SIZE;
+    long long previous_end = 0;
+    long long line = 1;
+
+    for (uint32_t block = 0; block < blocks && written; block++) {
+        const long long first = (long long) block * block_tokens;
+        const uint32_t count = (uint32_t) (table->count - first < block_tokens ? table->count - first : block_tokens);
+
+        unsigned char block_header[ARCHIVE_BLOCK_HEADER_SIZE];
+        write_u64(block_header + 8, previous_end);
+        write_u64(block_header + 16, line);
+
+        if (!encode_block(&encoder, table, context->content, first, count, &previous_end, &line)) {
+            written = false;
+            break;
+        }
+
+        uint64_t size = ARCHIVE_BLOCK_HEADER_SIZE;
+        write_u32(block_header, count);
+        write_u32(block_header + 4, encoder.texts_count);
+        for (int i = 0; i < SECTION_COUNT; i++) {
+            write_u32(block_header + 24 + 4 * i, (uint32_t) encoder.used[i]);
+            size += encoder.used[i];
+        }
+
+        written = size <= UINT32_MAX && fwrite(block_header, 1, sizeof(block_header), output) == sizeof(block_header);
+        for (int i = 0; i < SECTION_COUNT && written; i++) {
+            written = fwrite(encoder.sections[i], 1, encoder.used[i], output) == encoder.used[i];
+        }
+
+        unsigned char *record = index + (size_t) block * ARCHIVE_INDEX_RECORD_SIZE;
+        write_u64(record, position);
+        write_u32(record + 8, (uint32_t) size);
+        write_u32(record + 12, count);
+        write_u64(record + 16, first);
+        position += size;
+    }
+
+    size_t diagnostics_size = 0;
+    unsigned char *diagnostics = written ? encode_diagnostics(context, &diagnostics_size) : NULL;
+    if (diagnostics) {
+        const size_t index_size = (size_t) blocks * ARCHIVE_INDEX_RECORD_SIZE;
+        memcpy(header, TOKEN_ARCHIVE_MAGIC, 4);
+        write_u32(header + 4, TOKEN_ARCHIVE_VERSION);
+        write_u32(header + 8, block_tokens);
+        write_u32(header + 12, blocks);
+        write_u64(header + 16, table->count);
+        write_u64(header + 24, position);
+        write_u64(header + 32, position + index_size);
+
+        written = fwrite(index, 1, index_size, output) == index_size
+                  && fwrite(diagnostics, 1, diagnostics_size, output) == diagnostics_size
+                  && fseek(output, 0, SEEK_SET) == 0
+                  && fwrite(header, 1, sizeof(header), output) == sizeof(header);
+    } else {
+        written = false;
+    }
+    free(diagnostics);
+
+    if (index) {
+        encoder_free(&encoder);
+    }
+    free(index);
+    return written;
+}
+
+bool token_archive_write(const char *filename, const TokenTable *table, const TokenizerContext *context,
+                         const uint32_t block_tokens) {
+    if (block_tokens == 0) {
+        return false;
+    }
+
+    // Written next to the target and renamed over it, like indexes and packs, so readers
+    // never map a half-written archive. Devices such as /dev/null are written directly.
+    struct stat info;
+    const bool replace = stat(filename, &info) != 0 || S_ISREG(info.st_mode);
+
+    const size_t length = strlen(filename);
+    char *temporary = malloc(length + 5);
+    if (!temporary) {
+        return false;
+    }
+    memcpy(temporary, filename, length);
+    memcpy(temporary + length, ".tmp", 5);
+
+    FILE *output = fopen(replace ? temporary : filename, "wb");
+    if (!output) {
+        free(temporary);
+        return false;
+    }
+
+    bool written = write_blocks(output, table, context, block_tokens);
+    written = fclose(output) == 0 && written;
+    if (replace) {
+        written = written && rename(temporary, filename) == 0;
+        if (!written) {
+            unlink(temporary);
+        }
+    }
+
+    free(temporary);
+    return written;
+}
+
+TokenArchive *token_archive_open(const char *filename) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < ARCHIVE_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    const unsigned char *data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    TokenArchive *archive = calloc(1, sizeof(TokenArchive));
+    if (!archive) {
+        munmap((void *) data, info.st_size);
+        return NULL;
+    }
+
+    archive->data = data;
+    archive->size = info.st_size;
+    archive->block_tokens = read_u32(data + 8);
+    archive->blocks = read_u32(data + 12);
+    archive->tokens = read_u64(data + 16);
+    archive->index_offset = read_u64(data + 24);
+    archive->diagnostics_offset = read_u64(data + 32);
+
+    if (memcmp(data, TOKEN_ARCHIVE_MAGIC, 4) != 0
+        || read_u32(data + 4) != TOKEN_ARCHIVE_VERSION
+        || archive->index_offset > archive->size
+        || (uint64_t) archive->blocks * ARCHIVE_INDEX_RECORD_SIZE > archive->size - archive->index_offset
+        || archive->diagnostics_offset > archive->size) {
+        token_archive_close(archive);
+        return NULL;
+    }
+
+    return archive;
+}
+
+static bool block_reserve(TokenArchiveBlock *block, const uint32_t count, const uint32_t entries) {
+    if (count > block->capacity) {
+        uint8_t *types = realloc(block->types, count * sizeof(uint8_t));
+        if (types) {
+            block->types = types;
+        }
+        long long *offsets = realloc(block->offsets, count * sizeof(long long));
+        if (offsets) {
+            block->offsets = offsets;
+        }
+        uint32_t *lengths = realloc(block->lengths, count * sizeof(uint32_t));
+        if (lengths) {
+            block->lengths = lengths;
+        }
+        long long *lines = realloc(block->lines, count * sizeof(long long));
+        if (lines) {
+            block->lines = lines;
+        }
+        long long *columns = realloc(block->columns, count * sizeof(long long));
+        if (columns) {
+            block->columns = columns;
+        }
+        const char **texts = realloc(block->texts, count * sizeof(const char *));
+        if (texts) {
+            block->texts = texts;
+        }
+
+        if (!types || !offsets || !lengths || !lines || !columns || !texts) {
+            return false;
+        }
+        block->capacity = count;
+    }
+
+    if (entries > block->dictionary_capacity) {
+        const char **dictionary = realloc(block->dictionary, entries * sizeof(const char *));
+        if (dictionary) {
+            block->dictionary = dictionary;
+        }
+        uint32_t *dictionary_lengths = realloc(block->dictionary_lengths, entries * sizeof(uint32_t));
+        if (dictionary_lengths) {
+            block->dictionary_lengths = dictionary_lengths;
+        }
+
+        if (!dictionary || !dictionary_lengths) {
+            return false;
+        }
+        block->dictionary_capacity = entries;
+    }
+
+    return true;
+}
+
+bool token_archive_decode(const TokenArchive *archive, const uint32_t index, TokenArchiveBlock *block) {
+    if (index >= archive->blocks) {
+        return false;
+    }
+
+    const unsigned char *record = archive->data + archive->index_offset + (uint64_t) index * ARCHIVE_INDEX_RECORD_SIZE;
+    const uint64_t position = read_u64(record);
+    const uint32_t size = read_u32(record + 8);
+    if (position > archive->index_offset || size < ARCHIVE_BLOCK_HEADER_SIZE
+        || size > archive->index_offset - position) {
+        return false;
+    }
+
+    const unsigned char *data = archive->data + position;
+    const uint32_t count = read_u32(data);
+    const uint32_t entries = read_u32(data + 4);
+    long long end = (long long) read_u64(data + 8);
+    long long line = (long long) read_u64(data + 16);
+
+    const unsigned char *sections[SECTION_COUNT + 1];
+    sections[0] = data + ARCHIVE_BLOCK_HEADER_SIZE;
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        const uint32_t used = read_u32(data + 24 + 4 * i);
+        if ((ptrdiff_t) used > data + size - sections[i]) {
+            return false;
+        }
+        sections[i + 1] = sections[i] + used;
+    }
+
+    // Every dictionary entry takes at least its length byte, which bounds the untrusted
+    // entry count before anything is allocated for it.
+    if (sections[SECTION_TYPES + 1] - sections[SECTION_TYPES] != (ptrdiff_t) count
+        || entries > (uint64_t) (sections[SECTION_DICTIONARY + 1] - sections[SECTION_DICTIONARY])
+        || !block_reserve(block, count, entries)) {
+        return false;
+    }
+
+    long long fixed[TOKEN_TYPE_COUNT];
+    const unsigned char *cursor = sections[SECTION_LENGTHS];
+    for (int type = 0; type < TOKEN_TYPE_COUNT; type++) {
+        uint64_t value;
+        if (!get_varint(&cursor, sections[SECTION_LENGTHS + 1], &value)) {
+            return false;
+        }
+        fixed[type] = has_text((TokenType) type) ? LENGTH_TEXT : value ? (long long) value - 1 : LENGTH_SIZED;
+    }
+
+    cursor = sections[SECTION_DICTIONARY];
+    for (uint32_t i = 0; i < entries; i++) {
+        uint64_t length;
+        if (!get_varint(&cursor, sections[SECTION_DICTIONARY + 1], &length)
+            || length > (uint64_t) (sections[SECTION_DICTIONARY + 1] - cursor)) {
+            return false;
+        }
+        block->dictionary[i] = (const char *) cursor;
+        block->dictionary_lengths[i] = (uint32_t) length;
+        cursor += length;
+    }
+
+    const unsigned char *gaps = sections[SECTION_GAPS];
+    const unsigned char *sizes = sections[SECTION_SIZES];
+    const unsigned char *lines = sections[SECTION_LINES];
+    const unsigned char *references = sections[SECTION_REFERENCES];
+    const unsigned char *types = sections[SECTION_TYPES];
+    long long column = 1;
+    long long previous = end;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const TokenType type = (TokenType) types[i];
+        uint64_t gap;
+        uint64_t delta;
+        uint64_t value;
+        if (type >= TOKEN_TYPE_COUNT
+            || !get_varint(&gaps, sections[SECTION_GAPS + 1], &gap)
+            || !get_varint(&lines, sections[SECTION_LINES + 1], &delta)
+            || gap > COMPACT_TOKEN_MAX_OFFSET || delta > COMPACT_TOKEN_MAX_OFFSET) {
+            return false;
+        }
+
+        const long long offset = end + (long long) gap;
+        if (delta || i == 0) {
+            if (!get_varint(&lines, sections[SECTION_LINES + 1], &value)) {
+                return false;
+            }
+            column = (long long) value;
+        } else {
+            column += offset - previous;
+        }
+        line += (long long) delta;
+
+        long long length = fixed[type];
+        const char *text = NULL;
+        if (length == LENGTH_TEXT) {
+            if (!get_varint(&references, sections[SECTION_REFERENCES + 1], &value) || value >= entries) {
+                return false;
+            }
+            text = block->dictionary[value];
+            length = block->dictionary_lengths[value];
+        } else if (length == LENGTH_SIZED) {
+            if (!get_varint(&sizes, sections[SECTION_SIZES + 1], &value)) {
+                return false;
+            }
+            length = (long long) value;
+        }
+
+        block->types[i] = (uint8_t) type;
+        block->offsets[i] = offset;
+        block->lengths[i] = (uint32_t) length;
+        block->lines[i] = line;
+        block->columns[i] = column;
+        block->texts[i] = text;
+
+        previous = offset;
+        end = offset + length;
+    }
+
+    block->count = count;
+    block->first = read_u64(record + 16);
+    return true;
+}
+
+void token_archive_block_free(TokenArchiveBlock *block) {
+    free(block->types);
+    free(block->offsets);
+    free(block->lengths);
+    free(block->lines);
+    free(block->columns);
+    free(block->texts);
+    free(block->dictionary);
+    free(block->dictionary_lengths);
+    memset(block, 0, sizeof(*block));
+}
+
+static bool get_error(const unsigned char **cursor, const unsigned char *end, TokenizerError *diagnostic) {
+    uint64_t length;
+    if (!get_varint(cursor, end, &length) || length == 0 || length > (uint64_t) (end - *cursor)
+        || (*cursor)[length - 1] != '\0') {
+        return false;
+    }
+
+    diagnostic->message = (char *) *cursor;
+    *cursor += length;
+
+    uint64_t offset;
+    uint64_t line;
+    uint64_t column;
+    if (!get_varint(cursor, end, &offset) || !get_varint(cursor, end, &line) || !get_varint(cursor, end, &column)) {
+        return false;
+    }
+
+    diagnostic->frame = (TokenizerFrame) {(long long) offset, (long long) line, (long long) column};
+    return true;
+}
+
+bool token_archive_diagnostics(const TokenArchive *archive, TokenArchiveDiagnostics *diagnostics) {
+    memset(diagnostics, 0, sizeof(*diagnostics));
+
+    const unsigned char *cursor = archive->data + archive->diagnostics_offset;
+    const unsigned char *end = archive->data + archive->size;
+
+    // Every error takes at least five bytes and every pair two, which bounds the
+    // counts before anything is allocated.
+    uint64_t flags;
+    uint64_t count;
+    if (!get_varint(&cursor, end, &flags) || !get_varint(&cursor, end, &count)
+        || count > (uint64_t) (end - cursor) || count > UINT32_MAX) {
+        return false;
+    }
+
+    diagnostics->recover = flags & DIAGNOSTICS_RECOVER;
+    diagnostics->brackets = flags & DIAGNOSTICS_BRACKETS;
+    diagnostics->failed = flags & DIAGNOSTICS_FAILED;
+    diagnostics->errors = malloc(count ? count * sizeof(TokenizerError) : 1);
+    if (!diagnostics->errors) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!get_error(&cursor, end, &diagnostics->errors[i])) {
+            token_archive_diagnostics_free(diagnostics);
+            return false;
+        }
+        diagnostics->errors_count++;
+    }
+
+    if ((diagnostics->failed && !get_error(&cursor, end, &diagnostics->failure))
+        || !get_varint(&cursor, end, &count) || count > (uint64_t) (end - cursor) / 2) {
+        token_archive_diagnostics_free(diagnostics);
+        return false;
+    }
+
+    diagnostics->pairs = malloc(count ? count * 2 * sizeof(long long) : 1);
+    if (!diagnostics->pairs) {
+        token_archive_diagnostics_free(diagnostics);
+        return false;
+    }
+
+    uint64_t open = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t skip;
+        uint64_t distance;
+        if (!get_varint(&cursor, end, &skip) || !get_varint(&cursor, end, &distance)) {
+            token_archive_diagnostics_free(diagnostics);
+            return false;
+        }
+
+        open += skip;
+        diagnostics->pairs[2 * i] = (long long) open;
+        diagnostics->pairs[2 * i + 1] = (long long) (open + distance);
+    }
+    diagnostics->pairs_count = count;
+
+    return true;
+}
+
+void token_archive_diagnostics_free(TokenArchiveDiagnostics *diagnostics) {
+    free(diagnostics->errors);
+    free(diagnostics->pairs);
+    memset(diagnostics, 0, sizeof(*diagnostics));
+}
+
+void token_archive_close(TokenArchive *archive) {
+    if (!archive) {
+        return;
+    }
+
+    munmap((void *) archive->data, archive->size);
+    free(archive);
+}
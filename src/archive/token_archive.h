@@ -0,0 +1,100 @@
+#ifndef TOKEN_ARCHIVE_H
+#define TOKEN_ARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../tokenizer/token_table.h"
+
+#define TOKEN_ARCHIVE_MAGIC "AXTA"
+#define TOKEN_ARCHIVE_VERSION 1
+#define TOKEN_ARCHIVE_BLOCK_TOKENS 65536
+
+// On-disk layout, all integers little-endian:
+//   header       magic, version u32, tokens per block u32, blocks u32, tokens u64, then
+//                the u64 offsets of the block index and of the diagnostics (40 bytes)
+//   blocks       independently decodable, see below
+//   index        per block: file offset u64, size u32, tokens u32, first token u64
+//   diagnostics  varint flags (1 recover, 2 brackets, 4 failed), varint count of the
+//                collected errors, each a varint message length (with its terminating
+//                NUL), the message and varint offset, line and column; the error lexing
+//                stopped at in the same form when failed; then a varint count of matched
+//                bracket pairs, each a varint distance from the previous opening token
+//                and from its own opening token to the closing one
+//
+// A block starts with its token and dictionary counts (u32 each), the end offset and
+// line of the token before it (u64 each, 0 and 1 for the first block) and the byte
+// sizes of its sections (u32 each), followed by the sections:
+//   lengths     per token type, varint fixed length + 1, or 0 when it varies
+//   types       one byte per token
+//   gaps        varint distance from the previous token's end to the token
+//   sizes       varint length of each token whose type has no fixed length and no text
+//   lines       varint line delta, followed by a varint column when the delta is
+//               non-zero and for the first token of the block
+//   references  varint dictionary entry of each identifier, number, string and error token
+//   dictionary  distinct texts of the block, each a varint length and the bytes
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    uint32_t block_tokens;
+    uint32_t blocks;
+    uint64_t tokens;
+    uint64_t index_offset;
+    uint64_t diagnostics_offset;
+} TokenArchive;
+
+// One decoded block, one array per field. texts[i] points into the archive for tokens
+// that carry text and is NULL for operators and keywords, whose spelling is implied by
+// the type. Reusing the same block for further decodes avoids reallocating.
+typedef struct {
+    uint32_t count;
+    uint64_t first;
+    uint8_t *types;
+    long long *offsets;
+    uint32_t *lengths;
+    long long *lines;
+    long long *columns;
+    const char **texts;
+    uint32_t capacity;
+    const char **dictionary;
+    uint32_t *dictionary_lengths;
+    uint32_t dictionary_capacity;
+} TokenArchiveBlock;
+
+// Everything the JSON output reports next to the tokens, as stored in an archive.
+// Messages point into the archive.
+typedef struct {
+    bool recover;
+    bool brackets;
+    TokenizerError *errors;
+    uint32_t errors_count;
+    bool failed;
+    TokenizerError failure;
+    // Opening and closing token index of each matched pair, in order of the opening one.
+    long long *pairs;
+    uint64_t pairs_count;
+} TokenArchiveDiagnostics;
+
+// Encodes the tokens of `table`, built by lexing `context`, together with the context's
+// diagnostics and, without recovery, the thread's `error`. Texts come from the context's
+// content.
+bool token_archive_write(const char *filename, const TokenTable *table, const TokenizerContext *context,
+                         uint32_t block_tokens);
+
+TokenArchive *token_archive_open(const char *filename);
+
+// Decodes block `index`. Blocks share nothing, so they can be decoded in parallel
+// into separate TokenArchiveBlocks.
+bool token_archive_decode(const TokenArchive *archive, uint32_t index, TokenArchiveBlock *block);
+
+void token_archive_block_free(TokenArchiveBlock *block);
+
+bool token_archive_diagnostics(const TokenArchive *archive, TokenArchiveDiagnostics *diagnostics);
+
+void token_archive_diagnostics_free(TokenArchiveDiagnostics *diagnostics);
+
+void token_archive_close(TokenArchive *archive);
+
+#endif //TOKEN_ARCHIVE_H
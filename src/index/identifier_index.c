@@ -0,0 +1,617 @@
+#include "identifier_index.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../io/byte_codec.h"
+#include "../tokenizer/tokenizer.h"
+
+#define INDEX_HEADER_SIZE 48
+#define INDEX_FILE_RECORD_SIZE 16
+#define INDEX_TERM_RECORD_SIZE 24
+
+typedef struct {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+} IndexBuffer;
+
+typedef struct {
+    const char *name;
+    uint32_t length;
+    uint32_t file;
+    long long offset;
+} IndexEntry;
+
+static unsigned char *buffer_grow(IndexBuffer *buffer, const size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+
+        unsigned char *data = realloc(buffer->data, capacity);
+        if (!data) {
+            return NULL;
+        }
+
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    unsigned char *bytes = buffer->data + buffer->length;
+    buffer->length += length;
+    return bytes;
+}
+
+static bool buffer_append(IndexBuffer *buffer, const void *data, const size_t length) {
+    unsigned char *bytes = buffer_grow(buffer, length);
+    if (!bytes) {
+        return false;
+    }
+
+    memcpy(bytes, data, length);
+    return true;
+}
+
+static bool buffer_varint(IndexBuffer *buffer, const uint64_t value) {
+    unsigned char bytes[VARINT_MAX_BYTES];
+    return buffer_append(buffer, bytes, put_varint(bytes, value) - bytes);
+}
+
+char *index_path_normalize(const char *path) {
+    char *normalized = strdup(path);
+    if (!normalized) {
+        return NULL;
+    }
+
+    const bool absolute = normalized[0] == '/';
+    char *out = normalized + absolute;
+    const char *in = normalized;
+    while (*in) {
+        while (*in == '/') {
+            in++;
+        }
+
+        const char *segment = in;
+        while (*in && *in != '/') {
+            in++;
+        }
+
+        const size_t length = in - segment;
+        if (length == 0 || (length == 1 && segment[0] == '.')) {
+            continue;
+        }
+
+        if (out != normalized + absolute) {
+            *out++ = '/';
+        }
+        memmove(out, segment, length);
+        out += length;
+    }
+
+    if (out == normalized) {
+        *out++ = '.';
+    }
+    *out = '\0';
+    return normalized;
+}
+
+static bool append_occurrence(IndexFile *file, const char *name, const uint32_t length, const long long offset) {
+    if (file->count == file->capacity) {
+        const long long capacity = file->capacity ? file->capacity * 2 : 256;
+        IndexOccurrence *occurrences = realloc(file->occurrences, capacity * sizeof(IndexOccurrence));
+        if (!occurrences) {
+            return false;
+        }
+
+        file->occurrences = occurrences;
+        file->capacity = capacity;
+    }
+
+    file->occurrences[file->count++] = (IndexOccurrence) {name, length, offset};
+    return true;
+}
+
+bool index_file_scan(IndexFile *file, const char *path, char *content, const long long length) {
+    memset(file, 0, sizeof(*file));
+    file->path = index_path_normalize(path);
+    file->content = content;
+
+    TokenizerContext *context = file->path ? tokenizer_init_string("", 0) : NULL;
+    if (!context) {
+        return false;
+    }
+
+    tokenizer_recover(context, true);
+    tokenizer_reset(context, content, length);
+
+    bool scanned = true;
+    TokenType type;
+    while (tokenizer_scan(context, &type)) {
+        if (type == IDENTIFIER && !append_occurrence(file, &content[context->frame.offset],
+                                                     (uint32_t) (context->offset - context->frame.offset),
+                                                     context->frame.offset)) {
+            scanned = false;
+            break;
+        }
+    }
+
+    tokenizer_free(context);
+    return scanned;
+}
+
+void index_file_free(IndexFile *file) {
+    free(file->path);
+    free(file->content);
+    free(file->occurrences);
+    memset(file, 0, sizeof(*file));
+}
+
+static int compare_names(const char *a, const uint32_t a_length, const char *b, const uint32_t b_length) {
+    const int order = memcmp(a, b, a_length < b_length ? a_length : b_length);
+    if (order != 0) {
+        return order;
+    }
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+static int compare_entries(const void *left, const void *right) {
+    const IndexEntry *a = left;
+    const IndexEntry *b = right;
+
+    const int order = compare_names(a->name, a->length, b->name, b->length);
+    if (order != 0) {
+        return order;
+    }
+    if (a->file != b->file) {
+        return a->file < b->file ? -1 : 1;
+    }
+    return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+// Sections of the index being built. Terms are added in sorted order, each followed by
+// its postings sorted by (file, offset).
+typedef struct {
+    IndexBuffer file_table;
+    IndexBuffer term_table;
+    IndexBuffer postings;
+    IndexBuffer strings;
+    uint32_t files_count;
+    uint32_t terms_count;
+
+    // Term being added.
+    size_t term_strings;
+    uint32_t term_postings;
+    uint32_t previous_file;
+    long long previous_offset;
+} IndexWriter;
+
+static bool writer_file(IndexWriter *writer, const char *path, const uint32_t length, const uint32_t postings) {
+    unsigned char *record = buffer_grow(&writer->file_table, INDEX_FILE_RECORD_SIZE);
+    if (!record) {
+        return false;
+    }
+
+    write_u64(record, writer->strings.length);
+    write_u32(record + 8, length);
+    write_u32(record + 12, postings);
+    writer->files_count++;
+    return buffer_append(&writer->strings, path, length);
+}
+
+static bool writer_term(IndexWriter *writer, const char *name, const uint32_t length) {
+    writer->term_strings = writer->strings.length;
+    writer->term_postings = 0;
+    writer->previous_file = 0;
+    writer->previous_offset = 0;
+
+    unsigned char *record = buffer_grow(&writer->term_table, INDEX_TERM_RECORD_SIZE);
+    if (!record) {
+        return false;
+    }
+
+    write_u64(record, writer->strings.length);
+    write_u64(record + 8, writer->postings.length);
+    write_u32(record + 16, length);
+    return buffer_append(&writer->strings, name, length);
+}
+
+static bool writer_posting(IndexWriter *writer, const uint32_t file, const long long offset) {
+    const uint32_t file_delta = file - writer->previous_file;
+    const long long delta = file_delta ? offset : offset - writer->previous_offset;
+
+    writer->term_postings++;
+    writer->previous_file = file;
+    writer->previous_offset = offset;
+    return buffer_varint(&writer->postings, file_delta) && buffer_varint(&writer->postings, delta);
+}
+
+// A term left without postings, because all of them were in dropped files, is taken back.
+static void writer_end_term(IndexWriter *writer) {
+    if (writer->term_postings == 0) {
+        writer->term_table.length -= INDEX_TERM_RECORD_SIZE;
+        writer->strings.length = writer->term_strings;
+        return;
+    }
+
+    write_u32(writer->term_table.data + writer->term_table.length - INDEX_TERM_RECORD_SIZE + 20,
+              writer->term_postings);
+    writer->terms_count++;
+}
+
+// Writes a temporary file next to `filename` and renames it over, so readers holding
+// the old index mapped are not disturbed.
+static bool writer_save(const IndexWriter *writer, const char *filename) {
+    const size_t length = strlen(filename);
+    char *temporary = malloc(length + 5);
+    if (!temporary) {
+        return false;
+    }
+    memcpy(temporary, filename, length);
+    memcpy(temporary + length, ".tmp", 5);
+
+    FILE *output = fopen(temporary, "wb");
+    if (!output) {
+        free(temporary);
+        return false;
+    }
+
+    unsigned char header[INDEX_HEADER_SIZE];
+    const uint64_t files_offset = INDEX_HEADER_SIZE;
+    const uint64_t terms_offset = files_offset + writer->file_table.length;
+    const uint64_t postings_offset = terms_offset + writer->term_table.length;
+    const uint64_t strings_offset = postings_offset + writer->postings.length;
+
+    memcpy(header, IDENTIFIER_INDEX_MAGIC, 4);
+    write_u32(header + 4, IDENTIFIER_INDEX_VERSION);
+    write_u32(header + 8, writer->files_count);
+    write_u32(header + 12, writer->terms_count);
+    write_u64(header + 16, files_offset);
+    write_u64(header + 24, terms_offset);
+    write_u64(header + 32, postings_offset);
+    write_u64(header + 40, strings_offset);
+
+    bool written = fwrite(header, 1, sizeof(header), output) == sizeof(header)
+                   && fwrite(writer->file_table.data, 1, writer->file_table.length, output) == writer->file_table.length
+                   && fwrite(writer->term_table.data, 1, writer->term_table.length, output) == writer->term_table.length
+                   && fwrite(writer->postings.data, 1, writer->postings.length, output) == writer->postings.length
+                   && fwrite(writer->strings.data, 1, writer->strings.length, output) == writer->strings.length;
+    written = fclose(output) == 0 && written;
+    written = written && rename(temporary, filename) == 0;
+
+    if (!written) {
+        unlink(temporary);
+    }
+
+    free(temporary);
+    return written;
+}
+
+static void writer_free(IndexWriter *writer) {
+    free(writer->file_table.data);
+    free(writer->term_table.data);
+    free(writer->postings.data);
+    free(writer->strings.data);
+}
+
+// Adds the files that are not removed, numbered after the ones already in the writer,
+// and returns their occurrences sorted by (name, file, offset).
+static IndexEntry *writer_files(IndexWriter *writer, const IndexFile *files, const int count, long long *entries_count) {
+    long long total = 0;
+    for (int i = 0; i < count; i++) {
+        if (!files[i].removed) {
+            total += files[i].count;
+        }
+    }
+
+    IndexEntry *entries = malloc((total ? total : 1) * sizeof(IndexEntry));
+    if (!entries) {
+        return NULL;
+    }
+
+    *entries_count = 0;
+    for (int i = 0; i < count; i++) {
+        const IndexFile *file = &files[i];
+        if (file->removed) {
+            continue;
+        }
+
+        const uint32_t file_id = writer->files_count;
+        if (!writer_file(writer, file->path, (uint32_t) strlen(file->path), (uint32_t) file->count)) {
+            free(entries);
+            return NULL;
+        }
+
+        for (long long j = 0; j < file->count; j++) {
+            const IndexOccurrence *occurrence = &file->occurrences[j];
+            entries[(*entries_count)++] = (IndexEntry) {occurrence->name, occurrence->length, file_id, occurrence->offset};
+        }
+    }
+
+    qsort(entries, *entries_count, sizeof(IndexEntry), compare_entries);
+    return entries;
+}
+
+// Merges the terms of a previous index, if any, with the sorted new entries in one pass.
+// Old postings are re-encoded with their files renumbered through `remap` and dropped
+// where it holds UINT32_MAX; new postings follow them, as new files are numbered last.
+static bool writer_terms(IndexWriter *writer, const IdentifierIndex *index, const uint32_t *remap,
+                         const IndexEntry *entries, const long long entries_count) {
+    const uint32_t terms_count = index ? index->terms_count : 0;
+    uint32_t term = 0;
+    long long next = 0;
+
+    while (term < terms_count || next < entries_count) {
+        const char *name = NULL;
+        uint32_t length = 0;
+        IndexPostings postings = {0};
+
+        if (term < terms_count) {
+            const unsigned char *record = index->data + index->terms_offset + (uint64_t) term * INDEX_TERM_RECORD_SIZE;
+            const uint64_t name_offset = index->strings_offset + read_u64(record);
+            const uint64_t postings_offset = index->postings_offset + read_u64(record + 8);
+            length = read_u32(record + 16);
+            if (name_offset + length > index->size || postings_offset > index->strings_offset) {
+                return false;
+            }
+
+            name = (const char *) index->data + name_offset;
+            postings = (IndexPostings) {
+                index->data + postings_offset, index->data + index->strings_offset, read_u32(record + 20), 0, 0
+            };
+        }
+
+        long long end = next;
+        int order = -1;
+        if (next < entries_count) {
+            order = name ? compare_names(name, length, entries[next].name, entries[next].length) : 1;
+            while (end < entries_count && compare_names(entries[end].name, entries[end].length,
+                                                        entries[next].name, entries[next].length) == 0) {
+                end++;
+            }
+        }
+
+        if (order > 0) {
+            name = entries[next].name;
+            length = entries[next].length;
+        }
+
+        if (!writer_term(writer, name, length)) {
+            return false;
+        }
+
+        if (order <= 0) {
+            uint32_t file;
+            long long offset;
+            while (identifier_index_next(&postings, &file, &offset)) {
+                if (file < index->files_count && remap[file] != UINT32_MAX
+                    && !writer_posting(writer, remap[file], offset)) {
+                    return false;
+                }
+            }
+            term++;
+        }
+
+        if (order >= 0) {
+            for (; next < end; next++) {
+                if (!writer_posting(writer, entries[next].file, entries[next].offset)) {
+                    return false;
+                }
+            }
+        }
+
+        writer_end_term(writer);
+    }
+
+    return true;
+}
+
+bool identifier_index_write(const char *filename, const IndexFile *files, const int count) {
+    IndexWriter writer = {0};
+    long long entries_count;
+    IndexEntry *entries = writer_files(&writer, files, count, &entries_count);
+
+    const bool written = entries && writer_terms(&writer, NULL, NULL, entries, entries_count)
+                         && writer_save(&writer, filename);
+
+    free(entries);
+    writer_free(&writer);
+    return written;
+}
+
+static int compare_paths(const void *left, const void *right) {
+    return strcmp((*(const IndexFile *const *) left)->path, (*(const IndexFile *const *) right)->path);
+}
+
+static int find_path(const void *key, const void *element) {
+    return strcmp(key, (*(const IndexFile *const *) element)->path);
+}
+
+bool identifier_index_update(const char *filename, const IndexFile *files, const int count) {
+    IdentifierIndex *index = identifier_index_open(filename);
+    if (!index) {
+        return access(filename, F_OK) != 0 && identifier_index_write(filename, files, count);
+    }
+
+    // Carried-over files come first, keeping their relative order; changed and new files
+    // follow. Paths given for this update are sorted so each old path is one lookup.
+    const uint32_t carried = index->files_count;
+    uint32_t *remap = malloc((carried ? carried : 1) * sizeof(uint32_t));
+    const IndexFile **updated = malloc((count ? count : 1) * sizeof(IndexFile *));
+    IndexWriter writer = {0};
+    bool merged = remap && updated;
+
+    for (int i = 0; i < count && merged; i++) {
+        updated[i] = &files[i];
+    }
+    if (merged) {
+        qsort(updated, count, sizeof(IndexFile *), compare_paths);
+    }
+
+    for (uint32_t i = 0; i < carried && merged; i++) {
+        uint32_t length;
+        const char *path = identifier_index_path(index, i, &length);
+        char *copy = path ? strndup(path, length) : NULL;
+        char *normalized = copy ? index_path_normalize(copy) : NULL;
+        free(copy);
+
+        if (!normalized) {
+            merged = false;
+        } else if (bsearch(normalized, updated, count, sizeof(IndexFile *), find_path)) {
+            remap[i] = UINT32_MAX;
+        } else {
+            const unsigned char *record = index->data + index->files_offset + (uint64_t) i * INDEX_FILE_RECORD_SIZE;
+            remap[i] = writer.files_count;
+            merged = writer_file(&writer, normalized, (uint32_t) strlen(normalized), read_u32(record + 12));
+        }
+        free(normalized);
+    }
+
+    long long entries_count = 0;
+    IndexEntry *entries = merged ? writer_files(&writer, files, count, &entries_count) : NULL;
+    merged = entries && writer_terms(&writer, index, remap, entries, entries_count) && writer_save(&writer, filename);
+
+    free(entries);
+    writer_free(&writer);
+    free(updated);
+    free(remap);
+    identifier_index_close(index);
+    return merged;
+}
+
+IdentifierIndex *identifier_index_open(const char *filename) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < INDEX_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    const unsigned char *data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    IdentifierIndex *index = calloc(1, sizeof(IdentifierIndex));
+    if (!index) {
+        munmap((void *) data, info.st_size);
+        return NULL;
+    }
+
+    index->data = data;
+    index->size = info.st_size;
+    index->files_count = read_u32(data + 8);
+    index->terms_count = read_u32(data + 12);
+    index->files_offset = read_u64(data + 16);
+    index->terms_offset = read_u64(data + 24);
+    index->postings_offset = read_u64(data + 32);
+    index->strings_offset = read_u64(data + 40);
+
+    if (memcmp(data, IDENTIFIER_INDEX_MAGIC, 4) != 0
+        || read_u32(data + 4) != IDENTIFIER_INDEX_VERSION
+        || index->files_offset + (uint64_t) index->files_count * INDEX_FILE_RECORD_SIZE > index->terms_offset
+        || index->terms_offset + (uint64_t) index->terms_count * INDEX_TERM_RECORD_SIZE > index->postings_offset
+        || index->postings_offset > index->strings_offset
+        || index->strings_offset > index->size) {
+        identifier_index_close(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+bool identifier_index_lookup(const IdentifierIndex *index, const char *name, const long long length,
+                             IndexPostings *postings) {
+    uint32_t low = 0;
+    uint32_t high = index->terms_count;
+
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        const unsigned char *record = index->data + index->terms_offset + (uint64_t) middle * INDEX_TERM_RECORD_SIZE;
+        const uint64_t term_offset = index->strings_offset + read_u64(record);
+        const uint32_t term_length = read_u32(record + 16);
+        if (term_offset + term_length > index->size) {
+            return false;
+        }
+
+        const char *term = (const char *) index->data + term_offset;
+        int order = memcmp(term, name, term_length < length ? term_length : length);
+        if (order == 0 && term_length != length) {
+            order = term_length < length ? -1 : 1;
+        }
+
+        if (order == 0) {
+            postings->cursor = index->data + index->postings_offset + read_u64(record + 8);
+            postings->end = index->data + index->strings_offset;
+            postings->remaining = read_u32(record + 20);
+            postings->file = 0;
+            postings->offset = 0;
+            return true;
+        }
+
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return false;
+}
+
+bool identifier_index_next(IndexPostings *postings, uint32_t *file, long long *offset) {
+    if (postings->remaining == 0) {
+        return false;
+    }
+
+    uint64_t file_delta;
+    uint64_t offset_delta;
+    if (!get_varint(&postings->cursor, postings->end, &file_delta)
+        || !get_varint(&postings->cursor, postings->end, &offset_delta)) {
+        postings->remaining = 0;
+        return false;
+    }
+
+    postings->file += (uint32_t) file_delta;
+    postings->offset = file_delta ? (long long) offset_delta : postings->offset + (long long) offset_delta;
+    postings->remaining--;
+
+    *file = postings->file;
+    *offset = postings->offset;
+    return true;
+}
+
+const char *identifier_index_path(const IdentifierIndex *index, const uint32_t file, uint32_t *length) {
+    if (file >= index->files_count) {
+        return NULL;
+    }
+
+    const unsigned char *record = index->data + index->files_offset + (uint64_t) file * INDEX_FILE_RECORD_SIZE;
+    const uint64_t path = index->strings_offset + read_u64(record);
+    *length = read_u32(record + 8);
+    if (path + *length > index->size) {
+        return NULL;
+    }
+
+    return (const char *) index->data + path;
+}
+
+void identifier_index_close(IdentifierIndex *index) {
+    if (!index) {
+        return;
+    }
+
+    munmap((void *) index->data, index->size);
+    free(index);
+}
@@ -0,0 +1,88 @@
+#ifndef IDENTIFIER_INDEX_H
+#define IDENTIFIER_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define IDENTIFIER_INDEX_MAGIC "AXIX"
+#define IDENTIFIER_INDEX_VERSION 1
+
+// On-disk layout, all integers little-endian:
+//   header   magic, version u32, files u32, terms u32, then u64 offsets of the
+//            file table, term table, postings and string sections (48 bytes)
+//   files    per file: path offset u64, path length u32, postings u32
+//   terms    sorted by name: name offset u64, postings offset u64, name length u32, postings u32
+//   postings per term, sorted by (file, offset), as varint pairs: the file id delta, then the
+//            offset delta within the same file or the absolute offset after a file change
+//   strings  paths and identifier names
+
+typedef struct {
+    const char *name;
+    uint32_t length;
+    long long offset;
+} IndexOccurrence;
+
+// Identifier occurrences of one source file. Names point into `content`.
+typedef struct {
+    char *path;
+    char *content;
+    IndexOccurrence *occurrences;
+    long long count;
+    long long capacity;
+    bool removed;
+} IndexFile;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    uint32_t files_count;
+    uint32_t terms_count;
+    uint64_t files_offset;
+    uint64_t terms_offset;
+    uint64_t postings_offset;
+    uint64_t strings_offset;
+} IdentifierIndex;
+
+typedef struct {
+    const unsigned char *cursor;
+    const unsigned char *end;
+    uint32_t remaining;
+    uint32_t file;
+    long long offset;
+} IndexPostings;
+
+// Returns a copy of `path` with repeated slashes collapsed and "." segments dropped, so
+// "./src//a.axl" and "src/a.axl" name the same file. ".." is left alone. Every path
+// stored in an index is normalized this way.
+char *index_path_normalize(const char *path);
+
+// Lexes `content` in recovery mode and records every identifier. Takes ownership of
+// `content`, which must be NUL-terminated. Safe to call for different files in parallel.
+bool index_file_scan(IndexFile *file, const char *path, char *content, long long length);
+
+void index_file_free(IndexFile *file);
+
+// Writes the files that are not marked removed as a new index. The file is replaced
+// atomically, so readers holding the old one mapped are not disturbed.
+bool identifier_index_write(const char *filename, const IndexFile *files, int count);
+
+// Rewrites an existing index with `files` replacing the entries of the same path, new
+// paths added and removed ones dropped. Unchanged files are carried over without relexing:
+// their postings are streamed from the old index into the new one in a single merge
+// with the sorted entries of `files`.
+bool identifier_index_update(const char *filename, const IndexFile *files, int count);
+
+// Maps an index for querying.
+IdentifierIndex *identifier_index_open(const char *filename);
+
+bool identifier_index_lookup(const IdentifierIndex *index, const char *name, long long length, IndexPostings *postings);
+
+// Decodes the next occurrence of a looked-up identifier.
+bool identifier_index_next(IndexPostings *postings, uint32_t *file, long long *offset);
+
+const char *identifier_index_path(const IdentifierIndex *index, uint32_t file, uint32_t *length);
+
+void identifier_index_close(IdentifierIndex *index);
+
+#endif //IDENTIFIER_INDEX_H
@@ -0,0 +1,74 @@
+#ifndef BYTE_CODEC_H
+#define BYTE_CODEC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Little-endian integers and LEB128 varints, as used by every on-disk format here
+// (checkpoints, identifier index, source packs and token archives).
+
+#define VARINT_MAX_BYTES 10
+
+static inline void write_u32(unsigned char *bytes, const uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static inline void write_u64(unsigned char *bytes, const uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static inline uint32_t read_u32(const unsigned char *bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t) bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+static inline uint64_t read_u64(const unsigned char *bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t) bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+// Writes at most VARINT_MAX_BYTES and returns the position after the varint.
+static inline unsigned char *put_varint(unsigned char *bytes, uint64_t value) {
+    while (value >= 0x80) {
+        *bytes++ = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    *bytes++ = (unsigned char) value;
+    return bytes;
+}
+
+// Reads a varint that must end before `end` and advances the cursor past it. The
+// cursor is left alone on failure.
+static inline bool get_varint(const unsigned char **cursor, const unsigned char *end, uint64_t *value) {
+    const unsigned char *bytes = *cursor;
+    if (bytes < end && *bytes < 0x80) {
+        *value = *bytes;
+        *cursor = bytes + 1;
+        return true;
+    }
+
+    uint64_t result = 0;
+    for (int shift = 0; bytes < end && shift < 64; shift += 7) {
+        const unsigned char byte = *bytes++;
+        result |= (uint64_t) (byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            *value = result;
+            *cursor = bytes;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif //BYTE_CODEC_H
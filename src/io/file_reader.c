@@ -0,0 +1,579 @@
+#include "file_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define URING_CLOSE_TAG UINT64_MAX
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_OPENING,
+    SLOT_READING
+} SlotState;
+
+typedef struct {
+    SlotState state;
+    int index;
+    int fd;
+    char *content;
+    long long length;
+    long long size;
+} ReadSlot;
+
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned pending;
+} Uring;
+
+struct FileReader {
+    char **paths;
+    int count;
+    int depth;
+    bool uring;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+    bool stopping;
+
+    // Completed files waiting to be taken, a ring of `depth` entries.
+    FileReadResult *queue;
+    int queue_head;
+    int queue_count;
+    int taken;
+
+    // Files started but not yet delivered; written by the I/O thread under the lock.
+    int in_flight;
+
+    // I/O thread only.
+    int next;
+    ReadSlot *slots;
+    Uring ring;
+};
+
+static int uring_setup(const unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(const int fd, const unsigned submit, const unsigned complete, const unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static void uring_close(Uring *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+static bool uring_open(Uring *ring, const unsigned entries) {
+    memset(ring, 0, sizeof(*ring));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return false;
+    }
+
+    // OPENAT, READ and CLOSE arrived in the same release as RW_CUR_POS.
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        uring_close(ring);
+        return false;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        uring_close(ring);
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            uring_close(ring);
+            return false;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        uring_close(ring);
+        return false;
+    }
+
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return true;
+}
+
+// The ring is sized so that one submission per slot plus one close per slot always fits.
+static struct io_uring_sqe *uring_sqe(Uring *ring) {
+    const unsigned tail = *ring->sq_tail;
+    const unsigned index = tail & *ring->sq_mask;
+
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+    return sqe;
+}
+
+static bool uring_submit(Uring *ring, const unsigned wait) {
+    for (;;) {
+        const int submitted = uring_enter(ring->fd, ring->pending, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (submitted >= 0) {
+            ring->pending -= submitted;
+            return true;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+static void deliver(FileReader *reader, const FileReadResult *result, const bool started) {
+    pthread_mutex_lock(&reader->lock);
+    if (started) {
+        reader->in_flight--;
+    }
+    reader->queue[(reader->queue_head + reader->queue_count) % reader->depth] = *result;
+    reader->queue_count++;
+    pthread_cond_signal(&reader->ready);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+// Blocks until a started file can no longer overflow the completed queue.
+static bool wait_for_space(FileReader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    while (!reader->stopping && reader->queue_count + reader->in_flight >= reader->depth) {
+        pthread_cond_wait(&reader->space, &reader->lock);
+    }
+    const bool stopping = reader->stopping;
+    pthread_mutex_unlock(&reader->lock);
+    return !stopping;
+}
+
+static bool has_space(FileReader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    const bool space = !reader->stopping && reader->queue_count + reader->in_flight < reader->depth;
+    pthread_mutex_unlock(&reader->lock);
+    return space;
+}
+
+static void fail_slot(FileReader *reader, ReadSlot *slot, const int error) {
+    free(slot->content);
+
+    const FileReadResult result = {slot->index, NULL, 0, error};
+    slot->state = SLOT_FREE;
+    slot->content = NULL;
+    deliver(reader, &result, true);
+}
+
+static void finish_slot(FileReader *reader, ReadSlot *slot) {
+    slot->content[slot->length] = '\0';
+
+    const FileReadResult result = {slot->index, slot->content, slot->length, 0};
+    slot->state = SLOT_FREE;
+    slot->content = NULL;
+    deliver(reader, &result, true);
+}
+
+static void uring_close_fd(FileReader *reader, const int fd) {
+    struct io_uring_sqe *sqe = uring_sqe(&reader->ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = URING_CLOSE_TAG;
+}
+
+static void uring_read(FileReader *reader, ReadSlot *slot, const uint64_t user_data) {
+    struct io_uring_sqe *sqe = uring_sqe(&reader->ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot->fd;
+    sqe->addr = (uint64_t) (uintptr_t) (slot->content + slot->length);
+    sqe->len = (uint32_t) (slot->size - slot->length < (1LL << 30) ? slot->size - slot->length : 1LL << 30);
+    sqe->off = (uint64_t) slot->length;
+    sqe->user_data = user_data;
+}
+
+static void uring_opened(FileReader *reader, ReadSlot *slot, const uint64_t user_data, const int result) {
+    if (result < 0) {
+        fail_slot(reader, slot, -result);
+        return;
+    }
+
+    slot->fd = result;
+
+    struct stat info;
+    if (fstat(slot->fd, &info) != 0) {
+        const int failure = errno;
+        uring_close_fd(reader, slot->fd);
+        fail_slot(reader, slot, failure);
+        return;
+    }
+
+    slot->size = info.st_size;
+    slot->length = 0;
+    slot->content = malloc(slot->size + 1);
+    if (!slot->content) {
+        uring_close_fd(reader, slot->fd);
+        fail_slot(reader, slot, ENOMEM);
+        return;
+    }
+
+    if (slot->size == 0) {
+        uring_close_fd(reader, slot->fd);
+        finish_slot(reader, slot);
+        return;
+    }
+
+    slot->state = SLOT_READING;
+    uring_read(reader, slot, user_data);
+}
+
+static void uring_completed(FileReader *reader, ReadSlot *slot, const uint64_t user_data, const int result) {
+    if (result == -EINTR || result == -EAGAIN) {
+        uring_read(reader, slot, user_data);
+        return;
+    }
+
+    if (result < 0) {
+        uring_close_fd(reader, slot->fd);
+        fail_slot(reader, slot, -result);
+        return;
+    }
+
+    slot->length += result;
+    if (result > 0 && slot->length < slot->size) {
+        uring_read(reader, slot, user_data);
+        return;
+    }
+
+    uring_close_fd(reader, slot->fd);
+    finish_slot(reader, slot);
+}
+
+static void uring_start(FileReader *reader, ReadSlot *slot, const uint64_t user_data) {
+    slot->state = SLOT_OPENING;
+    slot->index = reader->next++;
+    slot->fd = -1;
+    slot->content = NULL;
+
+    pthread_mutex_lock(&reader->lock);
+    reader->in_flight++;
+    pthread_mutex_unlock(&reader->lock);
+
+    struct io_uring_sqe *sqe = uring_sqe(&reader->ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t) (uintptr_t) reader->paths[slot->index];
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = user_data;
+}
+
+// Returns false when io_uring itself fails; the files it had started are then still
+// in their slots and the rest are not started yet.
+static bool uring_loop(FileReader *reader) {
+    Uring *ring = &reader->ring;
+
+    while (reader->next < reader->count || reader->in_flight > 0) {
+        for (int i = 0; i < reader->depth && reader->next < reader->count; i++) {
+            if (reader->slots[i].state == SLOT_FREE && has_space(reader)) {
+                uring_start(reader, &reader->slots[i], (uint64_t) i);
+            }
+        }
+
+        if (reader->in_flight == 0) {
+            if (!wait_for_space(reader)) {
+                break;
+            }
+            continue;
+        }
+
+        if (!uring_submit(ring, 1)) {
+            return false;
+        }
+
+        unsigned head = *ring->cq_head;
+        const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            const uint64_t user_data = cqe->user_data;
+            const int result = cqe->res;
+
+            if (user_data == URING_CLOSE_TAG) {
+                continue;
+            }
+
+            ReadSlot *slot = &reader->slots[user_data];
+            if (slot->state == SLOT_OPENING) {
+                uring_opened(reader, slot, user_data, result);
+            } else {
+                uring_completed(reader, slot, user_data, result);
+            }
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // Flush any trailing closes without waiting for them.
+    if (ring->pending > 0) {
+        uring_submit(ring, 0);
+    }
+    return true;
+}
+
+static FileReadResult read_file(const char *path, const int index) {
+    FileReadResult result = {index, NULL, 0, 0};
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        result.error = errno;
+        return result;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !(result.content = malloc(info.st_size + 1))) {
+        result.error = errno ? errno : ENOMEM;
+        close(fd);
+        return result;
+    }
+
+    while (result.length < info.st_size) {
+        const ssize_t count = pread(fd, result.content + result.length, info.st_size - result.length, result.length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            result.error = errno;
+            free(result.content);
+            result.content = NULL;
+            result.length = 0;
+            close(fd);
+            return result;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        result.length += count;
+    }
+
+    result.content[result.length] = '\0';
+    close(fd);
+    return result;
+}
+
+static void pread_loop(FileReader *reader) {
+    while (reader->next < reader->count) {
+        if (!wait_for_space(reader)) {
+            break;
+        }
+
+        const FileReadResult result = read_file(reader->paths[reader->next], reader->next);
+        reader->next++;
+        deliver(reader, &result, false);
+    }
+}
+
+// Takes over after io_uring fails mid-run. Tearing the ring down cancels whatever it
+// still had queued, then the files it had started are read again with pread and the
+// remaining ones follow, so every consumer still gets a result for each file.
+static void uring_fallback(FileReader *reader) {
+    uring_close(&reader->ring);
+
+    for (int i = 0; i < reader->depth; i++) {
+        ReadSlot *slot = &reader->slots[i];
+        if (slot->state == SLOT_FREE) {
+            continue;
+        }
+
+        if (slot->fd >= 0) {
+            close(slot->fd);
+        }
+        free(slot->content);
+        slot->content = NULL;
+        slot->state = SLOT_FREE;
+
+        const FileReadResult result = read_file(reader->paths[slot->index], slot->index);
+        deliver(reader, &result, true);
+    }
+
+    pread_loop(reader);
+}
+
+static void *reader_thread(void *argument) {
+    FileReader *reader = argument;
+
+    if (!reader->uring) {
+        pread_loop(reader);
+    } else if (!uring_loop(reader)) {
+        uring_fallback(reader);
+    }
+
+    return NULL;
+}
+
+FileReader *file_reader_create(char **paths, const int count, const int depth, const bool uring) {
+    FileReader *reader = calloc(1, sizeof(FileReader));
+    if (!reader) {
+        return NULL;
+    }
+
+    reader->paths = paths;
+    reader->count = count;
+    reader->depth = depth > 0 ? depth : FILE_READER_DEFAULT_DEPTH;
+    reader->queue = calloc(reader->depth, sizeof(FileReadResult));
+    reader->slots = calloc(reader->depth, sizeof(ReadSlot));
+    reader->ring.fd = -1;
+
+    if (!reader->queue || !reader->slots) {
+        free(reader->queue);
+        free(reader->slots);
+        free(reader);
+        return NULL;
+    }
+
+    // Every slot may hold a read and a pending close at the same time.
+    reader->uring = uring && uring_open(&reader->ring, (unsigned) reader->depth * 2);
+
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->ready, NULL);
+    pthread_cond_init(&reader->space, NULL);
+
+    if (pthread_create(&reader->thread, NULL, reader_thread, reader) != 0) {
+        uring_close(&reader->ring);
+        pthread_mutex_destroy(&reader->lock);
+        pthread_cond_destroy(&reader->ready);
+        pthread_cond_destroy(&reader->space);
+        free(reader->queue);
+        free(reader->slots);
+        free(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+bool file_reader_next(FileReader *reader, FileReadResult *result) {
+    pthread_mutex_lock(&reader->lock);
+
+    while (reader->queue_count == 0 && reader->taken + reader->queue_count < reader->count && !reader->stopping) {
+        pthread_cond_wait(&reader->ready, &reader->lock);
+    }
+
+    if (reader->queue_count == 0) {
+        pthread_cond_broadcast(&reader->ready);
+        pthread_mutex_unlock(&reader->lock);
+        return false;
+    }
+
+    *result = reader->queue[reader->queue_head];
+    reader->queue_head = (reader->queue_head + 1) % reader->depth;
+    reader->queue_count--;
+    reader->taken++;
+
+    pthread_cond_signal(&reader->space);
+    if (reader->taken == reader->count) {
+        pthread_cond_broadcast(&reader->ready);
+    }
+
+    pthread_mutex_unlock(&reader->lock);
+    return true;
+}
+
+const char *file_reader_backend(const FileReader *reader) {
+    return reader->uring ? "io_uring" : "pread";
+}
+
+void file_reader_free(FileReader *reader) {
+    if (!reader) {
+        return;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    reader->stopping = true;
+    pthread_cond_broadcast(&reader->space);
+    pthread_cond_broadcast(&reader->ready);
+    pthread_mutex_unlock(&reader->lock);
+
+    pthread_join(reader->thread, NULL);
+
+    // Closing the ring first cancels reads that may still target the slot buffers.
+    uring_close(&reader->ring);
+
+    for (int i = 0; i < reader->queue_count; i++) {
+        free(reader->queue[(reader->queue_head + i) % reader->depth].content);
+    }
+    for (int i = 0; i < reader->depth; i++) {
+        free(reader->slots[i].content);
+    }
+
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->ready);
+    pthread_cond_destroy(&reader->space);
+    free(reader->queue);
+    free(reader->slots);
+    free(reader);
+}
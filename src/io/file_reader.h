@@ -0,0 +1,33 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include <stdbool.h>
+
+#define FILE_READER_DEFAULT_DEPTH 32
+
+typedef struct {
+    int index;
+    char *content;
+    long long length;
+    int error;
+} FileReadResult;
+
+typedef struct FileReader FileReader;
+
+// Starts a background thread that reads `paths` whole, keeping up to `depth` files
+// either in flight or waiting to be taken. Opens and reads are batched through
+// io_uring when the kernel allows it, otherwise the thread falls back to pread.
+FileReader *file_reader_create(char **paths, int count, int depth, bool uring);
+
+// Takes the next file that finished loading, in completion order. Blocks while reads
+// are outstanding and returns false once every file has been handed out. On success
+// `content` is NUL-terminated and owned by the caller; on failure `error` holds errno.
+// Safe to call from several threads.
+bool file_reader_next(FileReader *reader, FileReadResult *result);
+
+// Name of the backend actually in use, "io_uring" or "pread".
+const char *file_reader_backend(const FileReader *reader);
+
+void file_reader_free(FileReader *reader);
+
+#endif //FILE_READER_H
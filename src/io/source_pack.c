@@ -0,0 +1,201 @@
+#include "source_pack.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "byte_codec.h"
+
+#define PACK_HEADER_SIZE 24
+#define PACK_ENTRY_SIZE 24
+
+// Copies `length` bytes of the file at `path`, failing if it changed size since the
+// entry table was written.
+static bool copy_content(FILE *output, const char *path, const uint64_t length) {
+    FILE *input = fopen(path, "rb");
+    if (!input) {
+        return false;
+    }
+
+    char buffer[65536];
+    uint64_t copied = 0;
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+        copied += read;
+        if (copied > length || fwrite(buffer, 1, read, output) != read) {
+            fclose(input);
+            return false;
+        }
+    }
+
+    fclose(input);
+    return copied == length;
+}
+
+static bool write_sections(FILE *output, char **paths, const int count) {
+    const size_t table_size = (size_t) count * PACK_ENTRY_SIZE;
+    unsigned char *table = malloc(table_size ? table_size : 1);
+    uint64_t *lengths = malloc((count ? count : 1) * sizeof(uint64_t));
+    if (!table || !lengths) {
+        free(table);
+        free(lengths);
+        return false;
+    }
+
+    bool built = true;
+    uint64_t paths_size = 0;
+    uint64_t contents_size = 0;
+    for (int i = 0; i < count && built; i++) {
+        struct stat info;
+        const size_t path_length = strlen(paths[i]);
+        built = stat(paths[i], &info) == 0 && S_ISREG(info.st_mode)
+                && path_length <= UINT32_MAX && paths_size <= UINT32_MAX;
+        if (!built) {
+            fprintf(stderr, "%s: Cannot pack file\n", paths[i]);
+            break;
+        }
+
+        lengths[i] = info.st_size;
+        unsigned char *record = table + (size_t) i * PACK_ENTRY_SIZE;
+        write_u64(record, contents_size);
+        write_u64(record + 8, lengths[i]);
+        write_u32(record + 16, (uint32_t) paths_size);
+        write_u32(record + 20, (uint32_t) path_length);
+
+        contents_size += lengths[i];
+        paths_size += path_length + 1;
+    }
+
+    if (built) {
+        unsigned char header[PACK_HEADER_SIZE];
+        memcpy(header, SOURCE_PACK_MAGIC, 4);
+        write_u32(header + 4, SOURCE_PACK_VERSION);
+        write_u32(header + 8, (uint32_t) count);
+        write_u32(header + 12, 0);
+        write_u64(header + 16, PACK_HEADER_SIZE + table_size + paths_size);
+
+        built = fwrite(header, 1, sizeof(header), output) == sizeof(header)
+                && fwrite(table, 1, table_size, output) == table_size;
+        for (int i = 0; i < count && built; i++) {
+            built = fwrite(paths[i], 1, strlen(paths[i]) + 1, output) == strlen(paths[i]) + 1;
+        }
+        for (int i = 0; i < count && built; i++) {
+            built = copy_content(output, paths[i], lengths[i]);
+            if (!built) {
+                fprintf(stderr, "%s: File changed while packing\n", paths[i]);
+            }
+        }
+    }
+
+    free(table);
+    free(lengths);
+    return built;
+}
+
+bool source_pack_write(const char *filename, char **paths, const int count) {
+    const size_t length = strlen(filename);
+    char *temporary = malloc(length + 5);
+    if (!temporary) {
+        return false;
+    }
+    memcpy(temporary, filename, length);
+    memcpy(temporary + length, ".tmp", 5);
+
+    FILE *output = fopen(temporary, "wb");
+    if (!output) {
+        free(temporary);
+        return false;
+    }
+
+    bool written = write_sections(output, paths, count);
+    written = fclose(output) == 0 && written;
+    written = written && rename(temporary, filename) == 0;
+
+    if (!written) {
+        unlink(temporary);
+    }
+
+    free(temporary);
+    return written;
+}
+
+SourcePack *source_pack_open(const char *filename) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < PACK_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    const unsigned char *data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    SourcePack *pack = calloc(1, sizeof(SourcePack));
+    if (!pack) {
+        munmap((void *) data, info.st_size);
+        return NULL;
+    }
+
+    pack->data = data;
+    pack->size = info.st_size;
+    pack->count = read_u32(data + 8);
+    pack->paths_offset = PACK_HEADER_SIZE + (uint64_t) pack->count * PACK_ENTRY_SIZE;
+    pack->contents_offset = read_u64(data + 16);
+
+    if (memcmp(data, SOURCE_PACK_MAGIC, 4) != 0
+        || read_u32(data + 4) != SOURCE_PACK_VERSION
+        || pack->paths_offset > pack->contents_offset
+        || pack->contents_offset > pack->size) {
+        source_pack_close(pack);
+        return NULL;
+    }
+
+    // Workers touch the entries in no particular order; ask for the whole file up front.
+    madvise((void *) data, pack->size, MADV_WILLNEED);
+    return pack;
+}
+
+bool source_pack_entry(const SourcePack *pack, const uint32_t index, SourcePackEntry *entry) {
+    if (index >= pack->count) {
+        return false;
+    }
+
+    const unsigned char *record = pack->data + PACK_HEADER_SIZE + (uint64_t) index * PACK_ENTRY_SIZE;
+    const uint64_t content_offset = read_u64(record);
+    const uint64_t length = read_u64(record + 8);
+    const uint64_t path_offset = pack->paths_offset + read_u32(record + 16);
+    const uint32_t path_length = read_u32(record + 20);
+
+    const uint64_t contents_size = pack->size - pack->contents_offset;
+    if (content_offset > contents_size || length > contents_size - content_offset
+        || path_offset + path_length >= pack->contents_offset
+        || pack->data[path_offset + path_length] != '\0') {
+        return false;
+    }
+
+    entry->path = (const char *) pack->data + path_offset;
+    entry->path_length = path_length;
+    entry->content = (const char *) pack->data + pack->contents_offset + content_offset;
+    entry->length = (long long) length;
+    return true;
+}
+
+void source_pack_close(SourcePack *pack) {
+    if (!pack) {
+        return;
+    }
+
+    munmap((void *) pack->data, pack->size);
+    free(pack);
+}
@@ -0,0 +1,45 @@
+#ifndef SOURCE_PACK_H
+#define SOURCE_PACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SOURCE_PACK_MAGIC "AXPK"
+#define SOURCE_PACK_VERSION 1
+
+// On-disk layout, all integers little-endian:
+//   header   magic, version u32, entries u32, reserved u32, then the u64 offset of the
+//            contents section (24 bytes)
+//   entries  per file: content offset u64, content length u64, path offset u32, path length u32
+//   paths    NUL-terminated, offsets relative to the end of the entry table
+//   contents the files back to back, offsets relative to the contents section
+
+typedef struct {
+    const char *path;
+    uint32_t path_length;
+    const char *content;
+    long long length;
+} SourcePackEntry;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    uint32_t count;
+    uint64_t paths_offset;
+    uint64_t contents_offset;
+} SourcePack;
+
+// Packs the files at `paths` into `filename`, replacing it atomically.
+bool source_pack_write(const char *filename, char **paths, int count);
+
+// Maps a pack read-only. Entries point straight into the mapping, so any number of
+// threads can lex them in place without copying.
+SourcePack *source_pack_open(const char *filename);
+
+// Returns false when `index` is out of range or the entry points outside the file.
+bool source_pack_entry(const SourcePack *pack, uint32_t index, SourcePackEntry *entry);
+
+void source_pack_close(SourcePack *pack);
+
+#endif //SOURCE_PACK_H
@@ -1,52 +1,423 @@
+#include <errno.h>
 #include <json_writer.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "archive/token_archive.h"
+#include "index/identifier_index.h"
+#include "io/byte_codec.h"
+#include "io/file_reader.h"
+#include "io/source_pack.h"
+#include "server/server.h"
+#include "shm/token_ring.h"
+#include "tokenizer/compact_token.h"
+#include "tokenizer/header_scan.h"
+#include "tokenizer/token_table.h"
 #include "tokenizer/tokenizer.h"
+#include "trace/trace.h"
+
+#define COMPACT_FORMAT_MAGIC "AXCT"
+#define COMPACT_FORMAT_VERSION 1
+#define COMPACT_HEADER_SIZE 16
+#define COMPACT_RECORD_SIZE 12
+
+#define LEXER_CHUNK_TOKENS 1024
+
+typedef enum {
+    LEXER_FORMAT_JSON,
+    LEXER_FORMAT_JSON_COLUMNAR,
+    LEXER_FORMAT_COMPACT,
+    LEXER_FORMAT_ARCHIVE
+} LexerFormat;
 
 typedef struct {
     char *input_file;
     char *output_file;
+    LexerFormat format;
+    bool delta;
+    bool recover;
+    char *checkpoints_file;
+    long long checkpoint_interval;
+    char *serve_socket;
+    char *connect_socket;
+    int threads;
+    bool inline_source;
+    bool binary;
+    int requests;
+    int connections;
+    char *only;
+    bool trivia;
+    bool fingerprint;
+    bool header;
+    bool brackets;
+    bool batch;
+    char *pack_file;
+    char *decode_file;
+    int io_depth;
+    char *trace_file;
+    char *index_file;
+    char *index_update_file;
+    char *query_file;
+    bool uring;
+    char *shm_name;
+    uint32_t shm_capacity;
+    char **inputs;
+    int inputs_count;
 } LexerConfig;
 
+static bool lexer_filter_init(TokenizerContext *context, const char *only) {
+    TokenType types[TOKEN_TYPE_COUNT];
+    int count = 0;
+
+    char *list = strdup(only);
+    for (char *name = strtok(list, ","); name && count < TOKEN_TYPE_COUNT; name = strtok(NULL, ",")) {
+        if (!token_type_from_string(name, &types[count])) {
+            fprintf(stderr, "Unknown token type '%s'\n", name);
+            free(list);
+            return false;
+        }
+
+        count++;
+    }
+    free(list);
+
+    tokenizer_filter(context, types, count);
+    return true;
+}
+
+static bool lexer_context_init(TokenizerContext *context, const LexerConfig *config) {
+    tokenizer_recover(context, config->recover);
+    tokenizer_trivia(context, config->trivia);
+    tokenizer_brackets(context, config->brackets);
+    return !config->only || lexer_filter_init(context, config->only);
+}
+
+// Parses a whole positive number of KB into bytes, or returns -1.
+static long long parse_kilobytes(const char *text) {
+    char *end;
+    errno = 0;
+    const long long kilobytes = text ? strtoll(text, &end, 10) : 0;
+    if (!text || errno != 0 || end == text || *end != '\0' || kilobytes <= 0 || kilobytes > LLONG_MAX / 1024) {
+        return -1;
+    }
+
+    return kilobytes * 1024;
+}
+
 static LexerConfig lexer_config_init(const int argc, char **argv) {
-    LexerConfig config = {NULL, NULL};
+    LexerConfig config = {
+        .format = LEXER_FORMAT_JSON,
+        .checkpoint_interval = 64 * 1024,
+        .requests = 1,
+        .connections = 1,
+        .io_depth = FILE_READER_DEFAULT_DEPTH,
+        .uring = true,
+        .shm_capacity = TOKEN_RING_DEFAULT_CAPACITY,
+        .inputs = malloc(argc * sizeof(char *))
+    };
 
     for (int i = 1; i < argc;) {
         if (strcmp(argv[i], "-i") == 0) {
             config.input_file = argv[i + 1];
+            config.inputs[config.inputs_count++] = argv[i + 1];
             i += 2;
         } else if (strcmp(argv[i], "-o") == 0) {
             config.output_file = argv[i + 1];
             i += 2;
+        } else if (strcmp(argv[i], "--checkpoints") == 0) {
+            config.checkpoints_file = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--checkpoint-interval") == 0) {
+            config.checkpoint_interval = parse_kilobytes(argv[i + 1]);
+            i += 2;
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            config.serve_socket = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--connect") == 0) {
+            config.connect_socket = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--shm") == 0) {
+            config.shm_name = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--shm-capacity") == 0) {
+            config.shm_capacity = (uint32_t) strtoul(argv[i + 1], NULL, 10);
+            i += 2;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            config.threads = atoi(argv[i + 1]);
+            i += 2;
+        } else if (strcmp(argv[i], "--requests") == 0) {
+            config.requests = atoi(argv[i + 1]);
+            i += 2;
+        } else if (strcmp(argv[i], "--connections") == 0) {
+            config.connections = atoi(argv[i + 1]);
+            i += 2;
+        } else if (strcmp(argv[i], "--inline") == 0) {
+            config.inline_source = true;
+            i += 1;
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            config.binary = true;
+            i += 1;
+        } else if (strcmp(argv[i], "--format=json") == 0) {
+            config.format = LEXER_FORMAT_JSON;
+            i += 1;
+        } else if (strcmp(argv[i], "--format=json-columnar") == 0) {
+            config.format = LEXER_FORMAT_JSON_COLUMNAR;
+            i += 1;
+        } else if (strcmp(argv[i], "--delta") == 0) {
+            config.delta = true;
+            i += 1;
+        } else if (strcmp(argv[i], "--format=archive") == 0) {
+            config.format = LEXER_FORMAT_ARCHIVE;
+            i += 1;
+        } else if (strcmp(argv[i], "--decode") == 0) {
+            config.decode_file = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--format=compact") == 0) {
+            config.format = LEXER_FORMAT_COMPACT;
+            i += 1;
+        } else if (strncmp(argv[i], "--only=", 7) == 0) {
+            config.only = argv[i] + 7;
+            i += 1;
+        } else if (strcmp(argv[i], "--fingerprint") == 0) {
+            config.fingerprint = true;
+            i += 1;
+        } else if (strcmp(argv[i], "--brackets") == 0) {
+            config.brackets = true;
+            i += 1;
+        } else if (strcmp(argv[i], "--index") == 0) {
+            config.index_file = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--index-update") == 0) {
+            config.index_update_file = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--query") == 0) {
+            config.query_file = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            config.trace_file = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            config.batch = true;
+            i += 1;
+        } else if (strcmp(argv[i], "--pack") == 0) {
+            config.pack_file = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--io-depth") == 0) {
+            config.io_depth = atoi(argv[i + 1]);
+            i += 2;
+        } else if (strcmp(argv[i], "--no-uring") == 0) {
+            config.uring = false;
+            i += 1;
+        } else if (strcmp(argv[i], "--header") == 0) {
+            config.header = true;
+            i += 1;
+        } else if (strcmp(argv[i], "--trivia") == 0) {
+            config.trivia = true;
+            i += 1;
+        } else if (strcmp(argv[i], "--recover") == 0) {
+            config.recover = true;
+            i += 1;
+        } else if (argv[i][0] != '-') {
+            config.inputs[config.inputs_count++] = argv[i];
+            i += 1;
         } else {
             i += 1;
         }
     }
 
+    if (!config.input_file && config.inputs_count > 0) {
+        config.input_file = config.inputs[0];
+    }
+
+    if (!config.input_file && config.pack_file) {
+        config.input_file = config.pack_file;
+    }
+
+    if (!config.input_file && config.decode_file) {
+        config.input_file = config.decode_file;
+    }
+
     return config;
 }
 
-int main(const int argc, char **argv) {
-    const LexerConfig config = lexer_config_init(argc, argv);
+static void write_trivia(JsonWriter *jw, const TokenizerContext *context, const TriviaSpan span) {
+    jw_array_start(jw);
+    for (long long i = span.first; i < span.first + span.count; i++) {
+        const Trivia *trivia = &context->trivia[i];
+        jw_object_start(jw);
+        {
+            jw_key(jw, "kind"); jw_string(jw, trivia_kind_to_string(trivia->kind));
+            jw_key(jw, "offset"); jw_long(jw, trivia->offset);
+            jw_key(jw, "length"); jw_long(jw, trivia->length);
+        }
+        jw_object_end(jw);
+    }
+    jw_array_end(jw);
+}
 
-    if (!config.input_file) {
-        fprintf(stderr, "Input file not specified\n");
-        return 1;
+typedef struct {
+    char *content;
+    union {
+        int integer;
+        long long number;
+        float single;
+        double real;
+    };
+} LexerValue;
+
+static bool decode_value(const Token *token, LexerValue *value) {
+    value->content = token_content_to_value(token);
+
+    char *ptr;
+    switch (token->type) {
+        case DEC_NUMBER:
+            value->integer = strtol(value->content, &ptr, 10);
+            if (*ptr != '\0' || ptr == value->content) {
+                fprintf(stderr, "Failed to parse decimal number '%s'\n", value->content);
+                return false;
+            }
+            break;
+        case DEC_LONG_NUMBER:
+            value->number = strtoll(value->content, &ptr, 10);
+            if (*ptr != '\0' || ptr == value->content) {
+                fprintf(stderr, "Failed to parse long decimal number '%s'\n", value->content);
+                return false;
+            }
+            break;
+        case FLOAT_NUMBER:
+            value->single = strtof(value->content, &ptr);
+            if (*ptr != '\0' || ptr == value->content) {
+                fprintf(stderr, "Failed to parse float number '%s'\n", value->content);
+                return false;
+            }
+            break;
+        case DOUBLE_NUMBER:
+            value->real = strtod(value->content, &ptr);
+            if (*ptr != '\0' || ptr == value->content) {
+                fprintf(stderr, "Failed to parse double number '%s'\n", value->content);
+                return false;
+            }
+            break;
+        default:
     }
 
-    if (!config.output_file) {
-        fprintf(stderr, "Output file not specified\n");
-        return 1;
+    return true;
+}
+
+static bool has_value(const TokenType type) {
+    switch (type) {
+        case STRING_LITERAL:
+        case CHAR_LITERAL:
+        case IDENTIFIER:
+        case DEC_NUMBER:
+        case DEC_LONG_NUMBER:
+        case FLOAT_NUMBER:
+        case DOUBLE_NUMBER:
+            return true;
+        default:
+            return false;
     }
+}
 
-    TokenizerContext *context = tokenizer_init(config.input_file);
-    if (!context) {
-        fprintf(stderr, "Failed to read input file\n");
-        return 1;
+static void write_value(JsonWriter *jw, const TokenType type, const LexerValue *value) {
+    switch (type) {
+        case STRING_LITERAL:
+        case CHAR_LITERAL:
+        case IDENTIFIER:
+            jw_string(jw, value->content);
+            break;
+        case DEC_NUMBER:
+            jw_integer(jw, value->integer);
+            break;
+        case DEC_LONG_NUMBER:
+            jw_long(jw, value->number);
+            break;
+        case FLOAT_NUMBER:
+            jw_float(jw, value->single);
+            break;
+        case DOUBLE_NUMBER:
+            jw_double(jw, value->real);
+            break;
+        default:
+    }
+}
+
+static void write_token(JsonWriter *jw, const TokenizerContext *context, const LexerConfig *config,
+                        const Token *token, const TokenExtras *extras, const LexerValue *value) {
+    jw_object_start(jw);
+    {
+        jw_key(jw, "type"); jw_string(jw, token_type_to_string(token->type));
+        if (has_value(token->type)) {
+            jw_key(jw, "content"); write_value(jw, token->type, value);
+        }
+        jw_key(jw, "offset"); jw_long(jw, token->offset);
+        jw_key(jw, "length"); jw_long(jw, token->length);
+        jw_key(jw, "line"); jw_long(jw, token->line);
+        jw_key(jw, "column"); jw_long(jw, token->column);
+        if (config->brackets) {
+            jw_key(jw, "index"); jw_long(jw, extras->index);
+        }
+        if (config->trivia) {
+            jw_key(jw, "leading"); write_trivia(jw, context, extras->leading);
+            jw_key(jw, "trailing"); write_trivia(jw, context, extras->trailing);
+        }
+    }
+    jw_object_end(jw);
+}
+
+static void write_error(JsonWriter *jw, const TokenizerError *diagnostic) {
+    jw_object_start(jw);
+    {
+        jw_key(jw, "message"); jw_string(jw, diagnostic->message);
+        jw_key(jw, "offset"); jw_long(jw, diagnostic->frame.offset);
+        jw_key(jw, "line"); jw_long(jw, diagnostic->frame.line);
+        jw_key(jw, "column"); jw_long(jw, diagnostic->frame.column);
+    }
+    jw_object_end(jw);
+}
+
+static void write_diagnostics(JsonWriter *jw, const TokenizerContext *context, const LexerConfig *config) {
+    if (config->brackets) {
+        jw_key(jw, "brackets");
+        jw_array_start(jw);
+        for (long long i = 0; i < context->bracket_match_count; i++) {
+            const TokenizerBracketMatch *bracket = &context->bracket_match[i];
+            if (bracket->match > bracket->index) {
+                jw_array_start(jw);
+                jw_long(jw, bracket->index);
+                jw_long(jw, bracket->match);
+                jw_array_end(jw);
+            }
+        }
+        jw_array_end(jw);
+    }
+
+    if (config->recover) {
+        jw_key(jw, "errors");
+        jw_array_start(jw);
+        for (int i = 0; i < context->errors_count; i++) {
+            write_error(jw, &context->errors[i]);
+        }
+        jw_array_end(jw);
+    }
+
+    if (!config->recover) {
+        jw_key(jw, "error");
+        if (error.message) {
+            write_error(jw, &error);
+        } else {
+            jw_null(jw);
+        }
     }
+}
 
-    JsonWriter *jw = jw_open(config.output_file);
+static int write_json(TokenizerContext *context, const LexerConfig *config) {
+    JsonWriter *jw = jw_open(config->output_file);
     if (!jw) {
         fprintf(stderr, "Failed to open output file\n");
         return 1;
@@ -60,98 +431,1076 @@ int main(const int argc, char **argv) {
         jw_key(jw, "tokens");
         jw_array_start(jw);
         {
-            Token *token = tokenizer_next(context);
-            while (token) {
-                jw_object_start(jw);
-                {
-                    char *content = token_content_to_value(token);
-                    jw_key(jw, "type"); jw_string(jw, token_type_to_string(token->type));
-                    switch (token->type) {
-                        case STRING_LITERAL:
-                        case CHAR_LITERAL:
-                        case IDENTIFIER:
-                            jw_key(jw, "content"); jw_string(jw, content);
-                            break;
-                        case DEC_NUMBER: {
-                            char *ptr;
-                            const int number = strtol(content, &ptr, 10);
-                            if (*ptr != '\0' || ptr == content) {
-                                fprintf(stderr, "Failed to parse decimal number '%s'\n", content);
-                                return 1;
-                            }
+            Token *tokens[LEXER_CHUNK_TOKENS];
+            TokenExtras extras[LEXER_CHUNK_TOKENS];
+            LexerValue values[LEXER_CHUNK_TOKENS];
+            const bool with_extras = config->trivia || config->brackets;
+            int count;
 
-                            jw_key(jw, "content"); jw_integer(jw, number);
-                            break;
-                        }
-                        case DEC_LONG_NUMBER: {
-                            char *ptr;
-                            const long long number = strtoll(content, &ptr, 10);
-                            if (*ptr != '\0' || ptr == content) {
-                                fprintf(stderr, "Failed to parse long decimal number '%s'\n", content);
-                                return 1;
-                            }
-
-                            jw_key(jw, "content"); jw_long(jw, number);
-                            break;
-                        }
-                        case FLOAT_NUMBER: {
-                            char *ptr;
-                            const float number = strtof(content, &ptr);
-                            if (*ptr != '\0' || ptr == content) {
-                                fprintf(stderr, "Failed to parse float number '%s'\n", content);
-                                return 1;
-                            }
+            do {
+                uint64_t start = trace_now();
+                count = 0;
+                while (count < LEXER_CHUNK_TOKENS && (tokens[count] = tokenizer_next(context))) {
+                    if (with_extras) {
+                        extras[count] = *tokenizer_token_extras(context);
+                    }
+                    count++;
+                }
+                trace_span(TRACE_LEX, config->input_file, start);
 
-                            jw_key(jw, "content"); jw_float(jw, number);
-                            break;
-                        }
-                        case DOUBLE_NUMBER: {
-                            char *ptr;
-                            const double number = strtod(content, &ptr);
-                            if (*ptr != '\0' || ptr == content) {
-                                fprintf(stderr, "Failed to parse double number '%s'\n", content);
-                                return 1;
+                start = trace_now();
+                for (int i = 0; i < count; i++) {
+                    if (!decode_value(tokens[i], &values[i])) {
+                        for (int j = 0; j < count; j++) {
+                            if (j <= i) {
+                                free(values[j].content);
                             }
-
-                            jw_key(jw, "content"); jw_double(jw, number);
-                            break;
+                            free(tokens[j]->content);
+                            free(tokens[j]);
                         }
-                        default:
-                    }
-                    jw_key(jw, "offset"); jw_integer(jw, token->offset);
-                    jw_key(jw, "length"); jw_integer(jw, token->length);
-                    jw_key(jw, "line"); jw_integer(jw, token->line);
-                    jw_key(jw, "column"); jw_integer(jw, token->column);
-                    if (content) {
-                        free(content);
+                        jw_close(jw);
+                        return 1;
                     }
                 }
-                jw_object_end(jw);
+                trace_span(TRACE_DECODE, config->input_file, start);
 
-                free(token->content);
-                free(token);
+                start = trace_now();
+                for (int i = 0; i < count; i++) {
+                    write_token(jw, context, config, tokens[i], &extras[i], &values[i]);
 
-                token = tokenizer_next(context);
-            }
+                    free(values[i].content);
+                    free(tokens[i]->content);
+                    free(tokens[i]);
+                }
+                trace_span(TRACE_SERIALIZE, config->input_file, start);
+            } while (count == LEXER_CHUNK_TOKENS);
         }
         jw_array_end(jw);
 
-        jw_key(jw, "error");
-        if (error.message) {
-            jw_object_start(jw);
-            {
-                jw_key(jw, "message"); jw_string(jw, error.message);
-                jw_key(jw, "offset"); jw_integer(jw, error.frame.offset);
-                jw_key(jw, "line"); jw_integer(jw, error.frame.line);
-                jw_key(jw, "column"); jw_integer(jw, error.frame.column);
-            }
-            jw_object_end(jw);
-        } else {
-            jw_null(jw);
-        }
+        write_diagnostics(jw, context, config);
     }
     jw_object_end(jw);
+
+    const uint64_t start = trace_now();
     jw_close(jw);
+    trace_span(TRACE_WRITE, config->input_file, start);
+
+    return 0;
+}
+
+typedef struct {
+    TokenType type;
+    long long offset;
+    long long length;
+    long long line;
+    long long column;
+    long long index;
+} ColumnarToken;
+
+static bool grow(void **items, long long *capacity, const long long count, const size_t size) {
+    if (count < *capacity) {
+        return true;
+    }
+
+    const long long grown = *capacity ? *capacity * 2 : 1024;
+    void *resized = realloc(*items, grown * size);
+    if (!resized) {
+        return false;
+    }
+
+    *items = resized;
+    *capacity = grown;
+    return true;
+}
+
+// One array per token field instead of one object per token. Types are indices into
+// "legend", and "values" holds the decoded content of just the tokens whose type is
+// listed in "valued", in token order. With --delta, offsets and lines are stored as
+// differences from the previous token. With --brackets, "indexes" holds the token
+// indexes the bracket pairs refer to.
+static int write_json_columnar(TokenizerContext *context, const LexerConfig *config) {
+    ColumnarToken *tokens = NULL;
+    LexerValue *values = NULL;
+    long long count = 0;
+    long long capacity = 0;
+    long long values_count = 0;
+    long long values_capacity = 0;
+    bool collected = true;
+
+    uint64_t start = trace_now();
+    const Token *token;
+    while (collected && (token = tokenizer_advance(context))) {
+        if (!grow((void **) &tokens, &capacity, count, sizeof(ColumnarToken))
+            || (has_value(token->type) && !grow((void **) &values, &values_capacity, values_count, sizeof(LexerValue)))) {
+            fprintf(stderr, "Failed to allocate tokens\n");
+            collected = false;
+            break;
+        }
+
+        tokens[count++] = (ColumnarToken) {
+            token->type, token->offset, token->length, token->line, token->column,
+            tokenizer_token_extras(context)->index
+        };
+        if (has_value(token->type)) {
+            collected = decode_value(token, &values[values_count++]);
+        }
+    }
+    trace_span(TRACE_LEX, config->input_file, start);
+
+    JsonWriter *jw = collected ? jw_open(config->output_file) : NULL;
+    if (collected && !jw) {
+        fprintf(stderr, "Failed to open output file\n");
+    }
+
+    if (jw) {
+        start = trace_now();
+        jw_style_compact(jw);
+        jw_style_escape_unicode(jw, true);
+        jw_object_start(jw);
+        {
+            jw_key(jw, "format"); jw_string(jw, "columnar");
+            jw_key(jw, "version"); jw_integer(jw, 1);
+            jw_key(jw, "delta"); jw_bool(jw, config->delta);
+
+            jw_key(jw, "legend");
+            jw_array_start(jw);
+            for (int type = 0; type < TOKEN_TYPE_COUNT; type++) {
+                jw_string(jw, token_type_to_string((TokenType) type));
+            }
+            jw_array_end(jw);
+
+            jw_key(jw, "valued");
+            jw_array_start(jw);
+            for (int type = 0; type < TOKEN_TYPE_COUNT; type++) {
+                if (has_value((TokenType) type)) {
+                    jw_integer(jw, type);
+                }
+            }
+            jw_array_end(jw);
+
+            jw_key(jw, "count"); jw_long(jw, count);
+
+            jw_key(jw, "types");
+            jw_array_start(jw);
+            for (long long i = 0; i < count; i++) {
+                jw_integer(jw, tokens[i].type);
+            }
+            jw_array_end(jw);
+
+            jw_key(jw, "offsets");
+            jw_array_start(jw);
+            for (long long i = 0; i < count; i++) {
+                jw_long(jw, config->delta && i > 0 ? tokens[i].offset - tokens[i - 1].offset : tokens[i].offset);
+            }
+            jw_array_end(jw);
+
+            jw_key(jw, "lengths");
+            jw_array_start(jw);
+            for (long long i = 0; i < count; i++) {
+                jw_long(jw, tokens[i].length);
+            }
+            jw_array_end(jw);
+
+            jw_key(jw, "lines");
+            jw_array_start(jw);
+            for (long long i = 0; i < count; i++) {
+                jw_long(jw, config->delta && i > 0 ? tokens[i].line - tokens[i - 1].line : tokens[i].line);
+            }
+            jw_array_end(jw);
+
+            jw_key(jw, "columns");
+            jw_array_start(jw);
+            for (long long i = 0; i < count; i++) {
+                jw_long(jw, tokens[i].column);
+            }
+            jw_array_end(jw);
+
+            if (config->brackets) {
+                jw_key(jw, "indexes");
+                jw_array_start(jw);
+                for (long long i = 0; i < count; i++) {
+                    jw_long(jw, tokens[i].index);
+                }
+                jw_array_end(jw);
+            }
+
+            jw_key(jw, "values");
+            jw_array_start(jw);
+            for (long long i = 0, value = 0; i < count; i++) {
+                if (has_value(tokens[i].type)) {
+                    write_value(jw, tokens[i].type, &values[value++]);
+                }
+            }
+            jw_array_end(jw);
+
+            write_diagnostics(jw, context, config);
+        }
+        jw_object_end(jw);
+        trace_span(TRACE_SERIALIZE, config->input_file, start);
+
+        start = trace_now();
+        jw_close(jw);
+        trace_span(TRACE_WRITE, config->input_file, start);
+    }
+
+    for (long long i = 0; i < values_count; i++) {
+        free(values[i].content);
+    }
+    free(values);
+    free(tokens);
+
+    return jw ? 0 : 1;
+}
+
+static int write_compact(TokenizerContext *context, const LexerConfig *config) {
+    CompactTokenList list = {0};
+    uint64_t start = trace_now();
+    if (!tokenizer_collect(context, &list)) {
+        fprintf(stderr, "Failed to collect tokens\n");
+        compact_tokens_free(&list);
+        return 1;
+    }
+    trace_span(TRACE_LEX, config->input_file, start);
+
+    FILE *output = fopen(config->output_file, "wb");
+    if (!output) {
+        fprintf(stderr, "Failed to open output file\n");
+        compact_tokens_free(&list);
+        return 1;
+    }
+
+    // Every field is written little-endian at a fixed position, so the file is the same
+    // on any host. Records go out in chunks of LEXER_CHUNK_TOKENS.
+    start = trace_now();
+    unsigned char header[COMPACT_HEADER_SIZE];
+    memcpy(header, COMPACT_FORMAT_MAGIC, 4);
+    write_u32(header + 4, COMPACT_FORMAT_VERSION);
+    write_u64(header + 8, (uint64_t) list.count);
+    bool written = fwrite(header, 1, sizeof(header), output) == sizeof(header);
+
+    unsigned char records[LEXER_CHUNK_TOKENS * COMPACT_RECORD_SIZE];
+    for (long long i = 0; i < list.count && written; i += LEXER_CHUNK_TOKENS) {
+        const long long chunk = list.count - i < LEXER_CHUNK_TOKENS ? list.count - i : LEXER_CHUNK_TOKENS;
+        for (long long j = 0; j < chunk; j++) {
+            const CompactToken *token = &list.tokens[i + j];
+            unsigned char *record = records + j * COMPACT_RECORD_SIZE;
+            write_u32(record, token->offset_low);
+            record[4] = (unsigned char) token->offset_high;
+            record[5] = (unsigned char) (token->offset_high >> 8);
+            record[6] = token->type;
+            record[7] = 0;
+            write_u32(record + 8, token->length);
+        }
+        written = fwrite(records, COMPACT_RECORD_SIZE, chunk, output) == (size_t) chunk;
+    }
+    written = fclose(output) == 0 && written;
+    trace_span(TRACE_WRITE, config->input_file, start);
+    compact_tokens_free(&list);
+
+    if (!written) {
+        fprintf(stderr, "Failed to write output file\n");
+        return 1;
+    }
+
+    if (error.message) {
+        fprintf(stderr, "%lld:%lld: %s\n", error.frame.line, error.frame.column, error.message);
+    }
+
+    return 0;
+}
+
+static int write_archive(TokenizerContext *context, const LexerConfig *config) {
+    // Archives number tokens by position, which only matches the bracket indexes when
+    // no token is filtered out.
+    if (config->brackets && config->only) {
+        fprintf(stderr, "--brackets cannot be combined with --only in archives\n");
+        return 1;
+    }
+
+    TokenTable table;
+    uint64_t start = trace_now();
+    if (!token_table_build(&table, context)) {
+        fprintf(stderr, "Failed to collect tokens\n");
+        return 1;
+    }
+    trace_span(TRACE_LEX, config->input_file, start);
+
+    start = trace_now();
+    const bool written = token_archive_write(config->output_file, &table, context, TOKEN_ARCHIVE_BLOCK_TOKENS);
+    trace_span(TRACE_WRITE, config->input_file, start);
+    token_table_free(&table);
+
+    if (!written) {
+        fprintf(stderr, "Failed to write output file\n");
+        return 1;
+    }
+
+    if (error.message) {
+        fprintf(stderr, "%lld:%lld: %s\n", error.frame.line, error.frame.column, error.message);
+    }
+
+    return 0;
+}
 
+static int write_tokens(TokenizerContext *context, const LexerConfig *config) {
+    switch (config->format) {
+        case LEXER_FORMAT_COMPACT:
+            return write_compact(context, config);
+        case LEXER_FORMAT_JSON_COLUMNAR:
+            return write_json_columnar(context, config);
+        case LEXER_FORMAT_ARCHIVE:
+            return write_archive(context, config);
+        default:
+            return write_json(context, config);
+    }
+}
+
+static int write_checkpoints(const TokenizerContext *context, const LexerConfig *config) {
+    FILE *checkpoints = fopen(config->checkpoints_file, "wb");
+    if (!checkpoints) {
+        fprintf(stderr, "Failed to open checkpoints file\n");
+        return 1;
+    }
+
+    const bool written = tokenizer_write_checkpoints(checkpoints, context->checkpoints, context->checkpoints_count);
+    fclose(checkpoints);
+
+    if (!written) {
+        fprintf(stderr, "Failed to write checkpoints file\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int print_fingerprint(const LexerConfig *config) {
+    TokenizerContext *context = tokenizer_init(config->input_file);
+    if (!context) {
+        fprintf(stderr, "Failed to read input file\n");
+        return 1;
+    }
+
+    uint64_t digest[2];
+    if (!tokenizer_compute_fingerprint(context, digest)) {
+        fprintf(stderr, "%lld:%lld: %s\n", error.frame.line, error.frame.column, error.message);
+        tokenizer_free(context);
+        return 1;
+    }
+
+    printf("%016llx%016llx  %s\n", (unsigned long long) digest[0], (unsigned long long) digest[1],
+           config->input_file);
+
+    tokenizer_free(context);
     return 0;
+}
+
+static int write_shm(const LexerConfig *config) {
+    TokenizerContext *context = tokenizer_init(config->input_file);
+    if (!context) {
+        fprintf(stderr, "Failed to read input file\n");
+        return 1;
+    }
+
+    char *source = realpath(config->input_file, NULL);
+    TokenRing *ring = token_ring_create(config->shm_name, config->shm_capacity, source);
+    free(source);
+    if (!ring) {
+        fprintf(stderr, "Failed to create shared memory ring\n");
+        tokenizer_free(context);
+        return 1;
+    }
+
+    const bool lexed = token_ring_lex(ring, context);
+    token_ring_finish(ring, !lexed || error.message);
+    token_ring_close(ring);
+
+    if (!lexed) {
+        fprintf(stderr, "Failed to stream tokens to the consumer\n");
+    }
+
+    if (error.message) {
+        fprintf(stderr, "%lld:%lld: %s\n", error.frame.line, error.frame.column, error.message);
+    }
+
+    tokenizer_free(context);
+    return lexed ? 0 : 1;
+}
+
+typedef struct {
+    char **inputs;
+    TokenizerHeader *headers;
+    bool *loaded;
+    int count;
+    atomic_int next;
+    atomic_int failed;
+} HeaderJob;
+
+static void *header_worker(void *argument) {
+    HeaderJob *job = argument;
+
+    for (int i = atomic_fetch_add(&job->next, 1); i < job->count; i = atomic_fetch_add(&job->next, 1)) {
+        job->loaded[i] = tokenizer_scan_header(job->inputs[i], &job->headers[i]);
+        if (!job->loaded[i]) {
+            fprintf(stderr, "%s: Failed to scan header\n", job->inputs[i]);
+            atomic_store(&job->failed, 1);
+        }
+    }
+
+    return NULL;
+}
+
+static int lexer_threads(const LexerConfig *config) {
+    if (config->threads > 0) {
+        return config->threads;
+    }
+
+    const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return processors > 0 ? (int) processors : 1;
+}
+
+static int write_headers(const LexerConfig *config) {
+    HeaderJob job = {
+        config->inputs,
+        calloc(config->inputs_count, sizeof(TokenizerHeader)),
+        calloc(config->inputs_count, sizeof(bool)),
+        config->inputs_count,
+        0,
+        0
+    };
+
+    if (!job.headers || !job.loaded) {
+        fprintf(stderr, "Failed to allocate header results\n");
+        return 1;
+    }
+
+    const int threads = lexer_threads(config) < job.count ? lexer_threads(config) : job.count;
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, header_worker, &job);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    JsonWriter *jw = jw_open(config->output_file);
+    if (!jw) {
+        fprintf(stderr, "Failed to open output file\n");
+        return 1;
+    }
+
+    jw_style_pretty_tabs(jw);
+    jw_style_escape_unicode(jw, true);
+    jw_object_start(jw);
+    {
+        jw_key(jw, "files");
+        jw_array_start(jw);
+        for (int i = 0; i < job.count; i++) {
+            const TokenizerHeader *header = &job.headers[i];
+            jw_object_start(jw);
+            {
+                jw_key(jw, "path"); jw_string(jw, job.inputs[i]);
+                jw_key(jw, "package");
+                if (header->package) {
+                    jw_string(jw, header->package);
+                } else {
+                    jw_null(jw);
+                }
+
+                jw_key(jw, "imports");
+                jw_array_start(jw);
+                for (int j = 0; j < header->imports_count; j++) {
+                    jw_string(jw, header->imports[j]);
+                }
+                jw_array_end(jw);
+
+                jw_key(jw, "error");
+                if (!job.loaded[i]) {
+                    jw_string(jw, "failed to read input file");
+                } else if (header->error.message) {
+                    jw_string(jw, header->error.message);
+                } else {
+                    jw_null(jw);
+                }
+            }
+            jw_object_end(jw);
+        }
+        jw_array_end(jw);
+    }
+    jw_object_end(jw);
+    jw_close(jw);
+
+    for (int i = 0; i < job.count; i++) {
+        tokenizer_header_free(&job.headers[i]);
+    }
+    free(job.headers);
+    free(job.loaded);
+
+    return atomic_load(&job.failed) ? 1 : 0;
+}
+
+typedef struct {
+    const LexerConfig *config;
+    FileReader *reader;
+    atomic_int failed;
+} BatchJob;
+
+// Output files are named after the whole input path so inputs from different
+// directories cannot collide: src/a/b.axl becomes <dir>/src_a_b.axl.json.
+static char *batch_output_path(const LexerConfig *config, const char *input) {
+    const char *extension = config->format == LEXER_FORMAT_COMPACT
+                                ? ".tokens"
+                                : config->format == LEXER_FORMAT_ARCHIVE ? ".axta" : ".json";
+    while (input[0] == '.' && input[1] == '/') {
+        input += 2;
+    }
+    while (input[0] == '/') {
+        input++;
+    }
+
+    const size_t directory = strlen(config->output_file);
+    const size_t length = strlen(input);
+    char *path = malloc(directory + 1 + length + strlen(extension) + 1);
+    if (!path) {
+        return NULL;
+    }
+
+    memcpy(path, config->output_file, directory);
+    path[directory] = '/';
+    for (size_t i = 0; i < length; i++) {
+        path[directory + 1 + i] = input[i] == '/' ? '_' : input[i];
+    }
+    strcpy(path + directory + 1 + length, extension);
+    return path;
+}
+
+static void *batch_worker(void *argument) {
+    BatchJob *job = argument;
+    FileReadResult file;
+
+    // The context lexes each buffer in place; the reader's allocation is freed once the
+    // file has been written.
+    TokenizerContext *context = tokenizer_init_string("", 0);
+    if (!context || !lexer_context_init(context, job->config)) {
+        fprintf(stderr, "Failed to set up tokenizer\n");
+        atomic_store(&job->failed, 1);
+        tokenizer_free(context);
+        return NULL;
+    }
+
+    for (uint64_t start = trace_now(); file_reader_next(job->reader, &file); start = trace_now()) {
+        const char *input = job->config->inputs[file.index];
+        trace_span(TRACE_READ, input, start);
+        const uint64_t file_start = trace_now();
+        if (file.error) {
+            fprintf(stderr, "%s: %s\n", input, strerror(file.error));
+            atomic_store(&job->failed, 1);
+            continue;
+        }
+
+        LexerConfig config = *job->config;
+        config.input_file = (char *) input;
+        config.output_file = batch_output_path(job->config, input);
+
+        tokenizer_reset(context, file.content, file.length);
+        if (!config.output_file) {
+            fprintf(stderr, "%s: Failed to set up tokenizer\n", input);
+            atomic_store(&job->failed, 1);
+        } else if (write_tokens(context, &config) != 0) {
+            atomic_store(&job->failed, 1);
+        }
+
+        tokenizer_reset(context, "", 0);
+        free(file.content);
+        free(config.output_file);
+        trace_span(TRACE_FILE, input, file_start);
+    }
+
+    tokenizer_free(context);
+    return NULL;
+}
+
+static int write_batch(const LexerConfig *config) {
+    if (mkdir(config->output_file, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create output directory\n");
+        return 1;
+    }
+
+    BatchJob job = {config, NULL, 0};
+    job.reader = file_reader_create(config->inputs, config->inputs_count, config->io_depth, config->uring);
+    if (!job.reader) {
+        fprintf(stderr, "Failed to start file reader\n");
+        return 1;
+    }
+
+    const int threads = lexer_threads(config) < config->inputs_count ? lexer_threads(config) : config->inputs_count;
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, batch_worker, &job);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    file_reader_free(job.reader);
+    return atomic_load(&job.failed) ? 1 : 0;
+}
+
+typedef struct {
+    const LexerConfig *config;
+    SourcePack *pack;
+    atomic_uint next;
+    atomic_int failed;
+} PackJob;
+
+// Entries are lexed straight out of the mapping: one context per worker is pointed at
+// each entry in turn, so positions come out relative to that entry's own file.
+static void *pack_worker(void *argument) {
+    PackJob *job = argument;
+    TokenizerContext *context = tokenizer_init_string("", 0);
+    if (!context || !lexer_context_init(context, job->config)) {
+        fprintf(stderr, "Failed to set up tokenizer\n");
+        atomic_store(&job->failed, 1);
+        tokenizer_free(context);
+        return NULL;
+    }
+
+    for (uint32_t i = atomic_fetch_add(&job->next, 1); i < job->pack->count; i = atomic_fetch_add(&job->next, 1)) {
+        SourcePackEntry entry;
+        if (!source_pack_entry(job->pack, i, &entry)) {
+            fprintf(stderr, "Pack entry %u is corrupt\n", i);
+            atomic_store(&job->failed, 1);
+            continue;
+        }
+
+        const uint64_t file_start = trace_now();
+        LexerConfig config = *job->config;
+        config.input_file = (char *) entry.path;
+        config.output_file = batch_output_path(job->config, entry.path);
+
+        tokenizer_reset(context, entry.content, entry.length);
+        if (!config.output_file) {
+            fprintf(stderr, "%s: Failed to set up tokenizer\n", entry.path);
+            atomic_store(&job->failed, 1);
+        } else if (write_tokens(context, &config) != 0) {
+            atomic_store(&job->failed, 1);
+        }
+
+        free(config.output_file);
+        trace_span(TRACE_FILE, entry.path, file_start);
+    }
+
+    tokenizer_free(context);
+    return NULL;
+}
+
+static int write_pack(const LexerConfig *config) {
+    if (mkdir(config->output_file, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create output directory\n");
+        return 1;
+    }
+
+    PackJob job = {config, source_pack_open(config->pack_file), 0, 0};
+    if (!job.pack) {
+        fprintf(stderr, "Failed to open pack file\n");
+        return 1;
+    }
+
+    int threads = lexer_threads(config);
+    if ((uint32_t) threads > job.pack->count) {
+        threads = job.pack->count ? (int) job.pack->count : 1;
+    }
+
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, pack_worker, &job);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    source_pack_close(job.pack);
+    return atomic_load(&job.failed) ? 1 : 0;
+}
+
+typedef struct {
+    const LexerConfig *config;
+    FileReader *reader;
+    IndexFile *files;
+    bool update;
+    atomic_int failed;
+} IndexJob;
+
+static void *index_worker(void *argument) {
+    IndexJob *job = argument;
+    FileReadResult file;
+
+    for (uint64_t start = trace_now(); file_reader_next(job->reader, &file); start = trace_now()) {
+        const char *input = job->config->inputs[file.index];
+        IndexFile *entry = &job->files[file.index];
+        trace_span(TRACE_READ, input, start);
+
+        // A file that disappeared since the last build is dropped from the index.
+        if (file.error == ENOENT && job->update) {
+            entry->path = index_path_normalize(input);
+            entry->removed = true;
+            continue;
+        }
+
+        if (file.error) {
+            fprintf(stderr, "%s: %s\n", input, strerror(file.error));
+            atomic_store(&job->failed, 1);
+            continue;
+        }
+
+        start = trace_now();
+        if (!index_file_scan(entry, input, file.content, file.length)) {
+            fprintf(stderr, "%s: Failed to index file\n", input);
+            atomic_store(&job->failed, 1);
+        }
+        trace_span(TRACE_LEX, input, start);
+    }
+
+    return NULL;
+}
+
+static int write_index(const LexerConfig *config, const char *filename, const bool update) {
+    IndexJob job = {config, NULL, calloc(config->inputs_count, sizeof(IndexFile)), update, 0};
+    if (!job.files) {
+        fprintf(stderr, "Failed to allocate index files\n");
+        return 1;
+    }
+
+    job.reader = file_reader_create(config->inputs, config->inputs_count, config->io_depth, config->uring);
+    if (!job.reader) {
+        fprintf(stderr, "Failed to start file reader\n");
+        free(job.files);
+        return 1;
+    }
+
+    const int threads = lexer_threads(config) < config->inputs_count ? lexer_threads(config) : config->inputs_count;
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, index_worker, &job);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    file_reader_free(job.reader);
+
+    int result = atomic_load(&job.failed) ? 1 : 0;
+    if (result == 0) {
+        const uint64_t start = trace_now();
+        const bool written = update
+                                 ? identifier_index_update(filename, job.files, config->inputs_count)
+                                 : identifier_index_write(filename, job.files, config->inputs_count);
+        trace_span(TRACE_WRITE, filename, start);
+
+        if (!written) {
+            fprintf(stderr, "Failed to write index file\n");
+            result = 1;
+        }
+    }
+
+    for (int i = 0; i < config->inputs_count; i++) {
+        index_file_free(&job.files[i]);
+    }
+    free(job.files);
+    return result;
+}
+
+static int query_index(const LexerConfig *config) {
+    IdentifierIndex *index = identifier_index_open(config->query_file);
+    if (!index) {
+        fprintf(stderr, "Failed to open index file\n");
+        return 1;
+    }
+
+    bool found = false;
+    for (int i = 0; i < config->inputs_count; i++) {
+        IndexPostings postings;
+        if (!identifier_index_lookup(index, config->inputs[i], (long long) strlen(config->inputs[i]), &postings)) {
+            continue;
+        }
+
+        uint32_t file;
+        long long offset;
+        while (identifier_index_next(&postings, &file, &offset)) {
+            uint32_t length;
+            const char *path = identifier_index_path(index, file, &length);
+            if (path) {
+                printf("%.*s:%lld: %s\n", (int) length, path, offset, config->inputs[i]);
+                found = true;
+            }
+        }
+    }
+
+    identifier_index_close(index);
+    return found ? 0 : 1;
+}
+
+typedef struct {
+    const TokenArchive *archive;
+    TokenArchiveBlock *blocks;
+    bool *decoded;
+    uint32_t first;
+    uint32_t count;
+    atomic_uint next;
+} DecodeJob;
+
+static void *decode_worker(void *argument) {
+    DecodeJob *job = argument;
+
+    for (uint32_t i = atomic_fetch_add(&job->next, 1); i < job->count; i = atomic_fetch_add(&job->next, 1)) {
+        job->decoded[i] = token_archive_decode(job->archive, job->first + i, &job->blocks[i]);
+    }
+
+    return NULL;
+}
+
+static bool write_archive_block(JsonWriter *jw, const LexerConfig *config, const TokenArchiveBlock *block) {
+    for (uint32_t i = 0; i < block->count; i++) {
+        Token token = {0};
+        token.type = (TokenType) block->types[i];
+        token.offset = block->offsets[i];
+        token.length = block->lengths[i];
+        token.line = block->lines[i];
+        token.column = block->columns[i];
+        const TokenExtras extras = {.index = (long long) (block->first + i)};
+
+        LexerValue value = {0};
+        if (block->texts[i] && has_value(token.type)) {
+            token.content = strndup(block->texts[i], block->lengths[i]);
+            const bool decoded = token.content && decode_value(&token, &value);
+            free(token.content);
+            if (!decoded) {
+                free(value.content);
+                return false;
+            }
+        }
+
+        write_token(jw, NULL, config, &token, &extras, &value);
+        free(value.content);
+    }
+
+    return true;
+}
+
+// Same keys as write_diagnostics, following the modes the archive was written with.
+static void write_archive_diagnostics(JsonWriter *jw, const TokenArchiveDiagnostics *diagnostics) {
+    if (diagnostics->brackets) {
+        jw_key(jw, "brackets");
+        jw_array_start(jw);
+        for (uint64_t i = 0; i < diagnostics->pairs_count; i++) {
+            jw_array_start(jw);
+            jw_long(jw, diagnostics->pairs[2 * i]);
+            jw_long(jw, diagnostics->pairs[2 * i + 1]);
+            jw_array_end(jw);
+        }
+        jw_array_end(jw);
+    }
+
+    if (diagnostics->recover) {
+        jw_key(jw, "errors");
+        jw_array_start(jw);
+        for (uint32_t i = 0; i < diagnostics->errors_count; i++) {
+            write_error(jw, &diagnostics->errors[i]);
+        }
+        jw_array_end(jw);
+    }
+
+    if (!diagnostics->recover) {
+        jw_key(jw, "error");
+        if (diagnostics->failed) {
+            write_error(jw, &diagnostics->failure);
+        } else {
+            jw_null(jw);
+        }
+    }
+}
+
+// Writes the tokens and diagnostics of an archive in the regular JSON format. Blocks
+// are decoded in parallel one window of -j blocks at a time, then serialized in order.
+static int decode_archive(const LexerConfig *config) {
+    TokenArchive *archive = token_archive_open(config->decode_file);
+    if (!archive) {
+        fprintf(stderr, "Failed to open archive file\n");
+        return 1;
+    }
+
+    TokenArchiveDiagnostics diagnostics;
+    if (!token_archive_diagnostics(archive, &diagnostics)) {
+        fprintf(stderr, "Archive file is corrupt\n");
+        token_archive_close(archive);
+        return 1;
+    }
+
+    const int threads = lexer_threads(config);
+    DecodeJob job = {archive, calloc(threads, sizeof(TokenArchiveBlock)), calloc(threads, sizeof(bool)), 0, 0, 0};
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    JsonWriter *jw = job.blocks && job.decoded && workers ? jw_open(config->output_file) : NULL;
+    if (!jw) {
+        fprintf(stderr, "Failed to open output file\n");
+    }
+
+    LexerConfig plain = *config;
+    plain.trivia = false;
+    plain.brackets = diagnostics.brackets;
+    bool written = jw != NULL;
+
+    if (jw) {
+        jw_style_pretty_tabs(jw);
+        jw_style_escape_unicode(jw, true);
+        jw_object_start(jw);
+        jw_key(jw, "tokens");
+        jw_array_start(jw);
+
+        for (uint32_t window = 0; window < archive->blocks && written; window += threads) {
+            job.first = window;
+            job.count = archive->blocks - window < (uint32_t) threads ? archive->blocks - window : (uint32_t) threads;
+            atomic_store(&job.next, 0);
+
+            uint64_t start = trace_now();
+            for (uint32_t i = 0; i < job.count; i++) {
+                pthread_create(&workers[i], NULL, decode_worker, &job);
+            }
+            for (uint32_t i = 0; i < job.count; i++) {
+                pthread_join(workers[i], NULL);
+            }
+            trace_span(TRACE_DECODE, config->decode_file, start);
+
+            start = trace_now();
+            for (uint32_t i = 0; i < job.count && written; i++) {
+                written = job.decoded[i] && write_archive_block(jw, &plain, &job.blocks[i]);
+            }
+            trace_span(TRACE_SERIALIZE, config->decode_file, start);
+        }
+
+        jw_array_end(jw);
+
+        write_archive_diagnostics(jw, &diagnostics);
+        jw_object_end(jw);
+
+        const uint64_t start = trace_now();
+        jw_close(jw);
+        trace_span(TRACE_WRITE, config->decode_file, start);
+
+        if (!written) {
+            fprintf(stderr, "Archive file is corrupt\n");
+        }
+    }
+
+    for (int i = 0; job.blocks && i < threads; i++) {
+        token_archive_block_free(&job.blocks[i]);
+    }
+    free(job.blocks);
+    free(job.decoded);
+    free(workers);
+    token_archive_diagnostics_free(&diagnostics);
+    token_archive_close(archive);
+    return written ? 0 : 1;
+}
+
+int main(const int argc, char **argv) {
+    const LexerConfig config = lexer_config_init(argc, argv);
+
+    if (config.checkpoint_interval < 0) {
+        fprintf(stderr, "Checkpoint interval must be a positive number of KB\n");
+        return 1;
+    }
+
+    if (config.serve_socket) {
+        return server_run(config.serve_socket, config.threads);
+    }
+
+    if (!config.input_file) {
+        fprintf(stderr, "Input file not specified\n");
+        return 1;
+    }
+
+    if (config.connect_socket) {
+        const ClientConfig client = {
+            config.connect_socket,
+            config.input_file,
+            config.output_file,
+            config.inline_source,
+            config.binary ? SERVER_FORMAT_BINARY : SERVER_FORMAT_JSON,
+            config.requests,
+            config.connections
+        };
+
+        return client_run(&client);
+    }
+
+    if (config.fingerprint) {
+        return print_fingerprint(&config);
+    }
+
+    if (config.trace_file && !trace_start(config.trace_file)) {
+        fprintf(stderr, "Failed to start tracing\n");
+        return 1;
+    }
+
+    if (config.query_file) {
+        return query_index(&config);
+    }
+
+    if (config.index_file || config.index_update_file) {
+        return config.index_file
+                   ? write_index(&config, config.index_file, false)
+                   : write_index(&config, config.index_update_file, true);
+    }
+
+    if (config.shm_name) {
+        return write_shm(&config);
+    }
+
+    if (!config.output_file) {
+        fprintf(stderr, "Output file not specified\n");
+        return 1;
+    }
+
+    if (config.header) {
+        return write_headers(&config);
+    }
+
+    if (config.batch) {
+        return write_batch(&config);
+    }
+
+    if (config.pack_file) {
+        return write_pack(&config);
+    }
+
+    if (config.decode_file) {
+        return decode_archive(&config);
+    }
+
+    const uint64_t file_start = trace_now();
+    TokenizerContext *context = tokenizer_init(config.input_file);
+    if (!context) {
+        fprintf(stderr, "Failed to read input file\n");
+        return 1;
+    }
+    trace_span(TRACE_READ, config.input_file, file_start);
+
+    if (!lexer_context_init(context, &config)) {
+        return 1;
+    }
+    if (config.checkpoints_file) {
+        tokenizer_record_checkpoints(context, config.checkpoint_interval);
+    }
+
+    int result = write_tokens(context, &config);
+
+    if (result == 0 && config.checkpoints_file) {
+        result = write_checkpoints(context, &config);
+    }
+
+    trace_span(TRACE_FILE, config.input_file, file_start);
+
+    return result;
 }
\ No newline at end of file
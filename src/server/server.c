@@ -0,0 +1,646 @@
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../tokenizer/compact_token.h"
+#include "../tokenizer/tokenizer.h"
+
+#define SERVER_BACKLOG 128
+#define SERVER_MAX_REQUEST (256u * 1024 * 1024)
+#define SERVER_MAX_FILE (1024u * 1024 * 1024)
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} ServerBuffer;
+
+typedef struct {
+    int listener;
+    ServerBuffer input;
+    ServerBuffer output;
+    TokenizerContext *context;
+} ServerWorker;
+
+static bool buffer_reserve(ServerBuffer *buffer, const size_t additional) {
+    if (buffer->length + additional <= buffer->capacity) {
+        return true;
+    }
+
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->length + additional) {
+        capacity *= 2;
+    }
+
+    char *data = realloc(buffer->data, capacity);
+    if (!data) {
+        return false;
+    }
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static bool buffer_append(ServerBuffer *buffer, const void *data, const size_t length) {
+    if (!buffer_reserve(buffer, length)) {
+        return false;
+    }
+
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return true;
+}
+
+static bool buffer_append_string(ServerBuffer *buffer, const char *content) {
+    return buffer_append(buffer, content, strlen(content));
+}
+
+static bool buffer_append_format(ServerBuffer *buffer, const char *format, const long long value) {
+    char number[32];
+    const int length = snprintf(number, sizeof(number), format, value);
+    return buffer_append(buffer, number, length);
+}
+
+static bool buffer_append_json_string(ServerBuffer *buffer, const char *content) {
+    if (!buffer_append(buffer, "\"", 1)) {
+        return false;
+    }
+
+    for (const unsigned char *c = (const unsigned char *) content; *c; c++) {
+        char escaped[8];
+        const char *part = escaped;
+        size_t length = 2;
+
+        switch (*c) {
+            case '"': part = "\\\""; break;
+            case '\\': part = "\\\\"; break;
+            case '\n': part = "\\n"; break;
+            case '\r': part = "\\r"; break;
+            case '\t': part = "\\t"; break;
+            default:
+                if (*c < 0x20) {
+                    length = snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+                } else {
+                    part = (const char *) c;
+                    length = 1;
+                }
+        }
+
+        if (!buffer_append(buffer, part, length)) {
+            return false;
+        }
+    }
+
+    return buffer_append(buffer, "\"", 1);
+}
+
+static bool write_json_value(ServerBuffer *out, const Token *token, const char *content, const char **failure) {
+    char number[64];
+    char *ptr;
+
+    switch (token->type) {
+        case STRING_LITERAL:
+        case CHAR_LITERAL:
+        case IDENTIFIER:
+            return buffer_append_string(out, ",\"content\":") && buffer_append_json_string(out, content);
+        case DEC_NUMBER: {
+            const int value = strtol(content, &ptr, 10);
+            if (*ptr != '\0' || ptr == content) {
+                *failure = "failed to parse decimal number";
+                return false;
+            }
+            return buffer_append_string(out, ",\"content\":") && buffer_append_format(out, "%lld", value);
+        }
+        case DEC_LONG_NUMBER: {
+            const long long value = strtoll(content, &ptr, 10);
+            if (*ptr != '\0' || ptr == content) {
+                *failure = "failed to parse long decimal number";
+                return false;
+            }
+            return buffer_append_string(out, ",\"content\":") && buffer_append_format(out, "%lld", value);
+        }
+        case FLOAT_NUMBER:
+        case DOUBLE_NUMBER: {
+            const double value = token->type == FLOAT_NUMBER ? strtof(content, &ptr) : strtod(content, &ptr);
+            if (*ptr != '\0' || ptr == content) {
+                *failure = "failed to parse floating point number";
+                return false;
+            }
+            snprintf(number, sizeof(number), token->type == FLOAT_NUMBER ? "%.9g" : "%.17g", value);
+            return buffer_append_string(out, ",\"content\":") && buffer_append_string(out, number);
+        }
+        default:
+            return true;
+    }
+}
+
+static bool write_json(ServerBuffer *out, TokenizerContext *context, const char **failure) {
+    if (!buffer_append_string(out, "{\"tokens\":[")) {
+        return false;
+    }
+
+    bool first = true;
+    const Token *token;
+    while ((token = tokenizer_advance(context))) {
+        char *content = token_content_to_value(token);
+
+        const bool written = buffer_append_string(out, first ? "{\"type\":" : ",{\"type\":")
+                             && buffer_append_json_string(out, token_type_to_string(token->type))
+                             && write_json_value(out, token, content, failure)
+                             && buffer_append_format(out, ",\"offset\":%lld", token->offset)
+                             && buffer_append_format(out, ",\"length\":%lld", token->length)
+                             && buffer_append_format(out, ",\"line\":%lld", token->line)
+                             && buffer_append_format(out, ",\"column\":%lld}", token->column);
+        free(content);
+
+        if (!written) {
+            return false;
+        }
+        first = false;
+    }
+
+    if (!buffer_append_string(out, "],\"error\":")) {
+        return false;
+    }
+
+    if (!error.message) {
+        return buffer_append_string(out, "null}");
+    }
+
+    return buffer_append_string(out, "{\"message\":")
+           && buffer_append_json_string(out, error.message)
+           && buffer_append_format(out, ",\"offset\":%lld", error.frame.offset)
+           && buffer_append_format(out, ",\"line\":%lld", error.frame.line)
+           && buffer_append_format(out, ",\"column\":%lld}}", error.frame.column);
+}
+
+static bool write_binary(ServerBuffer *out, TokenizerContext *context) {
+    TokenType type;
+    while (tokenizer_scan(context, &type)) {
+        const CompactToken record = compact_token_make(type, context->frame.offset,
+                                                       context->offset - context->frame.offset);
+
+        if (!buffer_append(out, &record, sizeof(record))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool recv_all(const int fd, void *data, size_t length) {
+    char *ptr = data;
+    while (length > 0) {
+        const ssize_t received = recv(fd, ptr, length, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+
+        ptr += received;
+        length -= received;
+    }
+
+    return true;
+}
+
+static bool send_all(const int fd, const void *data, size_t length) {
+    const char *ptr = data;
+    while (length > 0) {
+        const ssize_t sent = send(fd, ptr, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+
+        ptr += sent;
+        length -= sent;
+    }
+
+    return true;
+}
+
+// Fails with errno set to EFBIG for files larger than `limit` bytes, including ones
+// that keep growing while they are read.
+static bool read_file(ServerBuffer *buffer, const char *filename, const size_t limit) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+
+    if ((uint64_t) info.st_size > limit) {
+        close(fd);
+        errno = EFBIG;
+        return false;
+    }
+
+    if (!buffer_reserve(buffer, info.st_size + 1)) {
+        close(fd);
+        return false;
+    }
+
+    buffer->length = 0;
+    for (;;) {
+        if (!buffer_reserve(buffer, 4096)) {
+            close(fd);
+            return false;
+        }
+
+        const ssize_t count = read(fd, buffer->data + buffer->length, buffer->capacity - buffer->length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            close(fd);
+            return false;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        buffer->length += count;
+        if (buffer->length > limit) {
+            close(fd);
+            errno = EFBIG;
+            return false;
+        }
+    }
+
+    close(fd);
+    return true;
+}
+
+static bool respond_error(const int fd, const char *message);
+
+static bool respond(const int fd, const ServerStatus status, const void *data, const size_t length) {
+    // The header only has room for 32 bits; a truncated length would desync the stream.
+    if (length > UINT32_MAX) {
+        return respond_error(fd, "response too large");
+    }
+
+    const ServerResponseHeader header = {status, (uint32_t) length};
+    return send_all(fd, &header, sizeof(header)) && send_all(fd, data, length);
+}
+
+static bool respond_error(const int fd, const char *message) {
+    return respond(fd, SERVER_STATUS_ERROR, message, strlen(message));
+}
+
+static bool handle_request(ServerWorker *worker, const int fd, const ServerRequestHeader *header) {
+    worker->input.length = 0;
+    if (!buffer_reserve(&worker->input, header->length + 1) || !recv_all(fd, worker->input.data, header->length)) {
+        return false;
+    }
+    worker->input.length = header->length;
+
+    if (header->kind == SERVER_REQUEST_PATH) {
+        worker->input.data[header->length] = '\0';
+
+        char *path = strdup(worker->input.data);
+        const bool loaded = path && read_file(&worker->input, path, SERVER_MAX_FILE);
+        const bool too_large = !loaded && errno == EFBIG;
+        free(path);
+
+        if (!loaded) {
+            return respond_error(fd, too_large ? "input file too large" : "failed to read input file");
+        }
+    } else if (header->kind != SERVER_REQUEST_SOURCE) {
+        return respond_error(fd, "unknown request kind");
+    }
+
+    if (!worker->context && !(worker->context = tokenizer_init_string("", 0))) {
+        return respond_error(fd, "out of memory");
+    }
+
+    TokenizerContext *context = worker->context;
+    tokenizer_reset(context, worker->input.data, (long long) worker->input.length);
+
+    worker->output.length = 0;
+
+    const char *failure = "out of memory";
+    const bool written = header->format == SERVER_FORMAT_BINARY
+                             ? write_binary(&worker->output, context)
+                             : write_json(&worker->output, context, &failure);
+
+    if (!written) {
+        return respond_error(fd, failure);
+    }
+
+    if (header->format == SERVER_FORMAT_BINARY && error.message) {
+        return respond_error(fd, error.message);
+    }
+
+    return respond(fd, SERVER_STATUS_OK, worker->output.data, worker->output.length);
+}
+
+static void *server_worker(void *argument) {
+    ServerWorker *worker = argument;
+
+    for (;;) {
+        const int fd = accept(worker->listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+
+        ServerRequestHeader header;
+        while (recv_all(fd, &header, sizeof(header))) {
+            if (header.length > SERVER_MAX_REQUEST) {
+                respond_error(fd, "request too large");
+                break;
+            }
+
+            if (!handle_request(worker, fd, &header)) {
+                break;
+            }
+        }
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int socket_address(const char *socket_path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Socket path is too long\n");
+        return -1;
+    }
+
+    strcpy(address->sun_path, socket_path);
+    return 0;
+}
+
+int server_run(const char *socket_path, int threads) {
+    struct sockaddr_un address;
+    if (socket_address(socket_path, &address) != 0) {
+        return 1;
+    }
+
+    if (threads <= 0) {
+        threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads <= 0) {
+            threads = 1;
+        }
+    }
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        fprintf(stderr, "Failed to create socket\n");
+        return 1;
+    }
+
+    unlink(socket_path);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, SERVER_BACKLOG) != 0) {
+        fprintf(stderr, "Failed to listen on '%s'\n", socket_path);
+        close(listener);
+        return 1;
+    }
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    ServerWorker *workers = calloc(threads, sizeof(ServerWorker));
+    if (!workers) {
+        fprintf(stderr, "Failed to allocate workers\n");
+        close(listener);
+        unlink(socket_path);
+        return 1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_t thread;
+        workers[i].listener = listener;
+
+        if (pthread_create(&thread, NULL, server_worker, &workers[i]) != 0) {
+            fprintf(stderr, "Failed to start worker thread\n");
+            close(listener);
+            unlink(socket_path);
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+
+    fprintf(stderr, "Listening on '%s' with %d threads\n", socket_path, threads);
+
+    int received;
+    sigwait(&signals, &received);
+
+    close(listener);
+    unlink(socket_path);
+    return 0;
+}
+
+static int client_connect(const char *socket_path) {
+    struct sockaddr_un address;
+    if (socket_address(socket_path, &address) != 0) {
+        return -1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool client_request(const int fd, const ServerRequestHeader *request, const void *payload,
+                           ServerBuffer *response, ServerResponseHeader *header) {
+    if (!send_all(fd, request, sizeof(*request)) || !send_all(fd, payload, request->length)) {
+        return false;
+    }
+
+    if (!recv_all(fd, header, sizeof(*header))) {
+        return false;
+    }
+
+    response->length = 0;
+    if (!buffer_reserve(response, header->length) || !recv_all(fd, response->data, header->length)) {
+        return false;
+    }
+
+    response->length = header->length;
+    return true;
+}
+
+typedef struct {
+    const ClientConfig *config;
+    const ServerRequestHeader *request;
+    const void *payload;
+    int requests;
+    bool failed;
+} ClientWorker;
+
+static void *client_worker(void *argument) {
+    ClientWorker *worker = argument;
+    ServerBuffer response = {NULL, 0, 0};
+
+    const int fd = client_connect(worker->config->socket_path);
+    if (fd < 0) {
+        worker->failed = true;
+        return NULL;
+    }
+
+    for (int i = 0; i < worker->requests; i++) {
+        ServerResponseHeader header;
+        if (!client_request(fd, worker->request, worker->payload, &response, &header)
+            || header.status != SERVER_STATUS_OK) {
+            worker->failed = true;
+            break;
+        }
+    }
+
+    close(fd);
+    free(response.data);
+    return NULL;
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double) (end.tv_sec - start->tv_sec) + (double) (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int client_benchmark(const ClientConfig *config, const ServerRequestHeader *request, const void *payload) {
+    const int connections = config->connections > 0 ? config->connections : 1;
+
+    ClientWorker *workers = calloc(connections, sizeof(ClientWorker));
+    pthread_t *threads = calloc(connections, sizeof(pthread_t));
+    if (!workers || !threads) {
+        free(workers);
+        free(threads);
+        fprintf(stderr, "Failed to allocate client workers\n");
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < connections; i++) {
+        workers[i].config = config;
+        workers[i].request = request;
+        workers[i].payload = payload;
+        workers[i].requests = config->requests / connections + (i < config->requests % connections);
+        pthread_create(&threads[i], NULL, client_worker, &workers[i]);
+    }
+
+    bool failed = false;
+    for (int i = 0; i < connections; i++) {
+        pthread_join(threads[i], NULL);
+        failed |= workers[i].failed;
+    }
+
+    const double seconds = elapsed_seconds(&start);
+    free(workers);
+    free(threads);
+
+    if (failed) {
+        fprintf(stderr, "Some requests failed\n");
+        return 1;
+    }
+
+    printf("%d requests over %d connections in %.3f s: %.0f requests/s\n",
+           config->requests, connections, seconds, config->requests / seconds);
+    return 0;
+}
+
+int client_run(const ClientConfig *config) {
+    ServerBuffer payload = {NULL, 0, 0};
+
+    if (config->inline_source) {
+        if (!read_file(&payload, config->input_file, SERVER_MAX_REQUEST)) {
+            fprintf(stderr, errno == EFBIG ? "Input file too large to send inline\n" : "Failed to read input file\n");
+            return 1;
+        }
+    } else if (!buffer_append_string(&payload, config->input_file)) {
+        return 1;
+    }
+
+    const ServerRequestHeader request = {
+        config->inline_source ? SERVER_REQUEST_SOURCE : SERVER_REQUEST_PATH,
+        config->format,
+        (uint32_t) payload.length
+    };
+
+    if (config->requests > 1) {
+        const int result = client_benchmark(config, &request, payload.data);
+        free(payload.data);
+        return result;
+    }
+
+    const int fd = client_connect(config->socket_path);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to connect to '%s'\n", config->socket_path);
+        free(payload.data);
+        return 1;
+    }
+
+    ServerBuffer response = {NULL, 0, 0};
+    ServerResponseHeader header;
+    const bool received = client_request(fd, &request, payload.data, &response, &header);
+    close(fd);
+    free(payload.data);
+
+    if (!received) {
+        fprintf(stderr, "Failed to communicate with server\n");
+        free(response.data);
+        return 1;
+    }
+
+    if (header.status != SERVER_STATUS_OK) {
+        fprintf(stderr, "Server error: %.*s\n", (int) response.length, response.data);
+        free(response.data);
+        return 1;
+    }
+
+    FILE *output = config->output_file ? fopen(config->output_file, "wb") : stdout;
+    if (!output) {
+        fprintf(stderr, "Failed to open output file\n");
+        free(response.data);
+        return 1;
+    }
+
+    fwrite(response.data, 1, response.length, output);
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    free(response.data);
+    return 0;
+}
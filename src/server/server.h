@@ -0,0 +1,51 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Wire protocol, native byte order (both ends live on the same host):
+//   request:  ServerRequestHeader, then `length` bytes of path or inline source
+//   response: ServerResponseHeader, then `length` bytes of JSON, CompactToken records or an error message
+
+typedef enum {
+    SERVER_REQUEST_PATH,
+    SERVER_REQUEST_SOURCE
+} ServerRequestKind;
+
+typedef enum {
+    SERVER_FORMAT_JSON,
+    SERVER_FORMAT_BINARY
+} ServerFormat;
+
+typedef enum {
+    SERVER_STATUS_OK,
+    SERVER_STATUS_ERROR
+} ServerStatus;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t format;
+    uint32_t length;
+} ServerRequestHeader;
+
+typedef struct {
+    uint32_t status;
+    uint32_t length;
+} ServerResponseHeader;
+
+typedef struct {
+    const char *socket_path;
+    const char *input_file;
+    const char *output_file;
+    bool inline_source;
+    ServerFormat format;
+    int requests;
+    int connections;
+} ClientConfig;
+
+int server_run(const char *socket_path, int threads);
+
+int client_run(const ClientConfig *config);
+
+#endif //SERVER_H
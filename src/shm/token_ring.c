@@ -0,0 +1,326 @@
+#include "token_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TOKEN_RING_BATCH 256
+#define TOKEN_RING_SPIN 256
+#define TOKEN_RING_POLL_MS 100
+
+static void futex_wait(_Atomic uint32_t *word, const uint32_t expected, const struct timespec *timeout) {
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void sleep_ms(const int milliseconds) {
+    const struct timespec delay = {milliseconds / 1000, (milliseconds % 1000) * 1000000L};
+    nanosleep(&delay, NULL);
+}
+
+static uint64_t segment_size(const uint32_t capacity) {
+    return sizeof(TokenRingHeader) + (uint64_t) capacity * sizeof(CompactToken);
+}
+
+TokenRing *token_ring_create(const char *name, const uint32_t capacity, const char *source) {
+    uint32_t rounded = 1;
+    while (rounded < capacity && rounded < (1u << 31)) {
+        rounded <<= 1;
+    }
+
+    TokenRing *ring = calloc(1, sizeof(TokenRing));
+    if (!ring) {
+        return NULL;
+    }
+
+    const int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->size = segment_size(rounded);
+    if (ftruncate(fd, (off_t) ring->size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        free(ring);
+        return NULL;
+    }
+
+    ring->header = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring->header == MAP_FAILED) {
+        shm_unlink(name);
+        free(ring);
+        return NULL;
+    }
+
+    TokenRingHeader *header = ring->header;
+    header->capacity = rounded;
+    header->record_size = sizeof(CompactToken);
+    if (source) {
+        strncpy(header->source, source, TOKEN_RING_SOURCE_SIZE - 1);
+    }
+
+    atomic_store(&header->head, 0);
+    atomic_store(&header->tail, 0);
+    atomic_store(&header->state, TOKEN_RING_RUNNING);
+    atomic_store(&header->consumer, TOKEN_RING_CONSUMER_PENDING);
+    atomic_store_explicit(&header->magic, TOKEN_RING_MAGIC, memory_order_release);
+
+    ring->producer = true;
+    ring->limit = rounded;
+    return ring;
+}
+
+TokenRing *token_ring_open(const char *name, const int timeout_ms) {
+    int waited = 0;
+    int fd;
+
+    while ((fd = shm_open(name, O_RDWR, 0600)) < 0) {
+        if (waited >= timeout_ms) {
+            return NULL;
+        }
+
+        sleep_ms(10);
+        waited += 10;
+    }
+
+    struct stat info;
+    while (fstat(fd, &info) == 0 && (uint64_t) info.st_size < sizeof(TokenRingHeader)) {
+        if (waited >= timeout_ms) {
+            close(fd);
+            return NULL;
+        }
+
+        sleep_ms(10);
+        waited += 10;
+    }
+
+    TokenRing *ring = calloc(1, sizeof(TokenRing));
+    if (!ring) {
+        close(fd);
+        return NULL;
+    }
+
+    ring->size = info.st_size;
+    ring->header = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring->header == MAP_FAILED) {
+        free(ring);
+        return NULL;
+    }
+
+    while (atomic_load_explicit(&ring->header->magic, memory_order_acquire) != TOKEN_RING_MAGIC) {
+        if (waited >= timeout_ms) {
+            munmap(ring->header, ring->size);
+            free(ring);
+            return NULL;
+        }
+
+        sleep_ms(10);
+        waited += 10;
+    }
+
+    if (ring->header->record_size != sizeof(CompactToken)
+        || segment_size(ring->header->capacity) > ring->size) {
+        munmap(ring->header, ring->size);
+        free(ring);
+        return NULL;
+    }
+
+    atomic_store(&ring->header->consumer_pid, (int32_t) getpid());
+    atomic_store(&ring->header->consumer, TOKEN_RING_CONSUMER_ATTACHED);
+    return ring;
+}
+
+void token_ring_flush(TokenRing *ring) {
+    TokenRingHeader *header = ring->header;
+    if (ring->published == ring->position) {
+        return;
+    }
+
+    atomic_store_explicit(&header->head, ring->position, memory_order_seq_cst);
+    ring->published = ring->position;
+
+    atomic_fetch_add(&header->head_futex, 1);
+    if (atomic_load(&header->consumer_waiting)) {
+        futex_wake(&header->head_futex);
+    }
+}
+
+// Whether it is still worth waiting for the consumer to free space.
+static bool consumer_present(const TokenRingHeader *header, const int waited) {
+    switch (atomic_load(&header->consumer)) {
+        case TOKEN_RING_CONSUMER_PENDING:
+            return waited < TOKEN_RING_ATTACH_TIMEOUT_MS;
+        case TOKEN_RING_CONSUMER_ATTACHED:
+            return kill((pid_t) atomic_load(&header->consumer_pid), 0) == 0 || errno != ESRCH;
+        default:
+            return false;
+    }
+}
+
+// Sleeps in slices of TOKEN_RING_POLL_MS so a consumer that disappears without
+// releasing anything is noticed.
+static bool wait_for_space(TokenRing *ring) {
+    TokenRingHeader *header = ring->header;
+    const struct timespec poll = {0, TOKEN_RING_POLL_MS * 1000000L};
+    int waited = 0;
+
+    for (int spin = 0;; spin++) {
+        const uint64_t tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+        if (ring->position < tail + header->capacity) {
+            ring->limit = tail + header->capacity;
+            return true;
+        }
+
+        if (spin < TOKEN_RING_SPIN) {
+            continue;
+        }
+
+        if (!consumer_present(header, waited)) {
+            return false;
+        }
+
+        const uint32_t sequence = atomic_load(&header->tail_futex);
+        atomic_store(&header->producer_waiting, 1);
+        if (atomic_load(&header->tail) == tail && atomic_load(&header->consumer) != TOKEN_RING_CONSUMER_DETACHED) {
+            futex_wait(&header->tail_futex, sequence, &poll);
+            waited += TOKEN_RING_POLL_MS;
+        }
+        atomic_store(&header->producer_waiting, 0);
+    }
+}
+
+bool token_ring_push(TokenRing *ring, const CompactToken *token) {
+    TokenRingHeader *header = ring->header;
+
+    if (ring->position == ring->limit) {
+        token_ring_flush(ring);
+        if (!wait_for_space(ring)) {
+            return false;
+        }
+    }
+
+    header->records[ring->position & (header->capacity - 1)] = *token;
+    ring->position++;
+
+    if (ring->position - ring->published >= TOKEN_RING_BATCH) {
+        token_ring_flush(ring);
+    }
+
+    return true;
+}
+
+void token_ring_finish(TokenRing *ring, const bool failed) {
+    TokenRingHeader *header = ring->header;
+
+    token_ring_flush(ring);
+    atomic_store(&header->state, failed ? TOKEN_RING_FAILED : TOKEN_RING_FINISHED);
+    atomic_fetch_add(&header->head_futex, 1);
+    futex_wake(&header->head_futex);
+}
+
+bool token_ring_lex(TokenRing *ring, TokenizerContext *context) {
+    TokenType type;
+
+    while (tokenizer_scan(context, &type)) {
+        const long long length = context->offset - context->frame.offset;
+        if (context->frame.offset > COMPACT_TOKEN_MAX_OFFSET || length > UINT32_MAX) {
+            return false;
+        }
+
+        const CompactToken token = compact_token_make(type, context->frame.offset, length);
+        if (!token_ring_push(ring, &token)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint32_t token_ring_acquire(TokenRing *ring, const CompactToken **records) {
+    TokenRingHeader *header = ring->header;
+
+    for (int spin = 0; ring->position == ring->limit; spin++) {
+        ring->limit = atomic_load_explicit(&header->head, memory_order_acquire);
+        if (ring->position != ring->limit) {
+            break;
+        }
+
+        if (atomic_load(&header->state) != TOKEN_RING_RUNNING) {
+            ring->limit = atomic_load_explicit(&header->head, memory_order_acquire);
+            if (ring->position == ring->limit) {
+                return 0;
+            }
+            break;
+        }
+
+        if (spin < TOKEN_RING_SPIN) {
+            continue;
+        }
+
+        const uint32_t sequence = atomic_load(&header->head_futex);
+        atomic_store(&header->consumer_waiting, 1);
+        if (atomic_load(&header->head) == ring->position && atomic_load(&header->state) == TOKEN_RING_RUNNING) {
+            futex_wait(&header->head_futex, sequence, NULL);
+        }
+        atomic_store(&header->consumer_waiting, 0);
+    }
+
+    const uint32_t mask = header->capacity - 1;
+    const uint64_t available = ring->limit - ring->position;
+    const uint64_t contiguous = header->capacity - (ring->position & mask);
+
+    *records = &header->records[ring->position & mask];
+    return (uint32_t) (available < contiguous ? available : contiguous);
+}
+
+void token_ring_release(TokenRing *ring, const uint32_t count) {
+    TokenRingHeader *header = ring->header;
+
+    ring->position += count;
+    atomic_store_explicit(&header->tail, ring->position, memory_order_seq_cst);
+
+    atomic_fetch_add(&header->tail_futex, 1);
+    if (atomic_load(&header->producer_waiting)) {
+        futex_wake(&header->tail_futex);
+    }
+}
+
+TokenRingState token_ring_state(const TokenRing *ring) {
+    return atomic_load(&ring->header->state);
+}
+
+void token_ring_close(TokenRing *ring) {
+    if (!ring) {
+        return;
+    }
+
+    if (!ring->producer) {
+        TokenRingHeader *header = ring->header;
+        atomic_store(&header->consumer, TOKEN_RING_CONSUMER_DETACHED);
+        atomic_fetch_add(&header->tail_futex, 1);
+        futex_wake(&header->tail_futex);
+    }
+
+    munmap(ring->header, ring->size);
+    free(ring);
+}
+
+void token_ring_unlink(const char *name) {
+    shm_unlink(name);
+}
@@ -0,0 +1,98 @@
+#ifndef TOKEN_RING_H
+#define TOKEN_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../tokenizer/compact_token.h"
+
+#define TOKEN_RING_MAGIC 0x31474E49524B5441ULL
+#define TOKEN_RING_DEFAULT_CAPACITY (1u << 16)
+#define TOKEN_RING_SOURCE_SIZE 4096
+#define TOKEN_RING_ATTACH_TIMEOUT_MS 5000
+
+typedef enum {
+    TOKEN_RING_RUNNING,
+    TOKEN_RING_FINISHED,
+    TOKEN_RING_FAILED
+} TokenRingState;
+
+typedef enum {
+    TOKEN_RING_CONSUMER_PENDING,
+    TOKEN_RING_CONSUMER_ATTACHED,
+    TOKEN_RING_CONSUMER_DETACHED
+} TokenRingConsumer;
+
+// Layout of the shared-memory segment. head is only written by the producer and
+// tail only by the consumer; the futex words are bumped whenever either side moves
+// so the other one can sleep instead of spinning. consumer and consumer_pid let a
+// producer waiting for space notice a consumer that never attached, left or died.
+typedef struct {
+    _Atomic uint64_t magic;
+    uint32_t capacity;
+    uint32_t record_size;
+    char source[TOKEN_RING_SOURCE_SIZE];
+
+    _Alignas(64) _Atomic uint64_t head;
+    _Atomic uint32_t head_futex;
+    _Atomic uint32_t consumer_waiting;
+    _Atomic uint32_t state;
+
+    _Alignas(64) _Atomic uint64_t tail;
+    _Atomic uint32_t tail_futex;
+    _Atomic uint32_t producer_waiting;
+    _Atomic uint32_t consumer;
+    _Atomic int32_t consumer_pid;
+
+    _Alignas(64) CompactToken records[];
+} TokenRingHeader;
+
+// Process-local view of the ring. position is this side's private cursor; the
+// producer publishes it to head in batches, the consumer to tail on release.
+// limit caches how far the cursor may advance before the other side is consulted.
+typedef struct {
+    TokenRingHeader *header;
+    uint64_t size;
+    uint64_t position;
+    uint64_t published;
+    uint64_t limit;
+    bool producer;
+} TokenRing;
+
+// Creates the segment as producer. capacity is rounded up to a power of two.
+TokenRing *token_ring_create(const char *name, uint32_t capacity, const char *source);
+
+// Attaches to an existing segment as consumer, waiting up to timeout_ms for it to appear.
+TokenRing *token_ring_open(const char *name, int timeout_ms);
+
+// Returns false when the ring is full and the consumer is gone: it did not attach
+// within TOKEN_RING_ATTACH_TIMEOUT_MS, closed the ring or its process exited.
+bool token_ring_push(TokenRing *ring, const CompactToken *token);
+
+// Makes every pushed record visible to the consumer.
+void token_ring_flush(TokenRing *ring);
+
+void token_ring_finish(TokenRing *ring, bool failed);
+
+// Lexes the remaining input of the context straight into the ring, blocking while it
+// is full. Does not finish the ring, so several sources can be streamed back to back.
+// Fails like token_ring_push when the consumer is gone.
+bool token_ring_lex(TokenRing *ring, TokenizerContext *context);
+
+// Returns a contiguous run of published records directly in shared memory, blocking
+// until at least one is available. Returns 0 once the producer has finished.
+uint32_t token_ring_acquire(TokenRing *ring, const CompactToken **records);
+
+// Hands the first `count` acquired records back to the producer.
+void token_ring_release(TokenRing *ring, uint32_t count);
+
+TokenRingState token_ring_state(const TokenRing *ring);
+
+// Unmaps the ring. Closing a consumer marks it detached, so a producer blocked on a
+// full ring gives up instead of waiting for it.
+void token_ring_close(TokenRing *ring);
+
+void token_ring_unlink(const char *name);
+
+#endif //TOKEN_RING_H
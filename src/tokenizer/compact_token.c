@@ -0,0 +1,103 @@
+#include "compact_token.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool tokenizer_lines_build(TokenizerLines *lines, const char *content, const long long length) {
+    long long count = 1;
+    for (const char *c = memchr(content, '\n', length); c; c = memchr(c + 1, '\n', length - (c + 1 - content))) {
+        count++;
+    }
+
+    long long *starts = malloc(count * sizeof(long long));
+    if (!starts) {
+        return false;
+    }
+
+    long long index = 0;
+    starts[index++] = 0;
+    for (const char *c = memchr(content, '\n', length); c; c = memchr(c + 1, '\n', length - (c + 1 - content))) {
+        starts[index++] = c + 1 - content;
+    }
+
+    lines->starts = starts;
+    lines->count = count;
+    return true;
+}
+
+void tokenizer_lines_locate(const TokenizerLines *lines, const long long offset, long long *line, long long *column) {
+    long long low = 0;
+    long long high = lines->count - 1;
+
+    while (low < high) {
+        const long long middle = low + (high - low + 1) / 2;
+
+        if (lines->starts[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    *line = low + 1;
+    *column = offset - lines->starts[low] + 1;
+}
+
+void tokenizer_lines_free(TokenizerLines *lines) {
+    free(lines->starts);
+    lines->starts = NULL;
+    lines->count = 0;
+}
+
+static bool reserve(CompactTokenList *list) {
+    if (list->count < list->capacity) {
+        return true;
+    }
+
+    const long long capacity = list->capacity ? list->capacity * 2 : 1024;
+    CompactToken *tokens = realloc(list->tokens, capacity * sizeof(CompactToken));
+    if (!tokens) {
+        return false;
+    }
+
+    list->tokens = tokens;
+    list->capacity = capacity;
+    return true;
+}
+
+bool tokenizer_collect(TokenizerContext *context, CompactTokenList *list) {
+    TokenType type;
+
+    while (tokenizer_scan(context, &type)) {
+        const long long length = context->offset - context->frame.offset;
+        if (context->frame.offset > COMPACT_TOKEN_MAX_OFFSET || length > UINT32_MAX || !reserve(list)) {
+            return false;
+        }
+
+        list->tokens[list->count++] = compact_token_make(type, context->frame.offset, length);
+    }
+
+    return true;
+}
+
+bool compact_tokens_locate(CompactTokenList *list, const TokenizerContext *context, const long long index,
+                           long long *line, long long *column) {
+    if (index < 0 || index >= list->count) {
+        return false;
+    }
+
+    if (!list->lines.starts && !tokenizer_lines_build(&list->lines, context->content, context->content_length)) {
+        return false;
+    }
+
+    tokenizer_lines_locate(&list->lines, compact_token_offset(&list->tokens[index]), line, column);
+    return true;
+}
+
+void compact_tokens_free(CompactTokenList *list) {
+    free(list->tokens);
+    tokenizer_lines_free(&list->lines);
+    list->tokens = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
@@ -0,0 +1,73 @@
+#ifndef COMPACT_TOKEN_H
+#define COMPACT_TOKEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tokenizer.h"
+
+#define COMPACT_TOKEN_MAX_OFFSET ((1LL << 48) - 1)
+
+// 12-byte token record: 8-bit type, 48-bit byte offset and 32-bit length.
+// Line and column are recovered on demand from a TokenizerLines table.
+typedef struct {
+    uint32_t offset_low;
+    uint16_t offset_high;
+    uint8_t type;
+    uint8_t reserved;
+    uint32_t length;
+} CompactToken;
+
+typedef struct {
+    long long *starts;
+    long long count;
+} TokenizerLines;
+
+typedef struct {
+    CompactToken *tokens;
+    long long count;
+    long long capacity;
+    TokenizerLines lines;
+} CompactTokenList;
+
+static inline CompactToken compact_token_make(const TokenType type, const long long offset, const long long length) {
+    const CompactToken token = {
+        (uint32_t) offset,
+        (uint16_t) (offset >> 32),
+        (uint8_t) type,
+        0,
+        (uint32_t) length
+    };
+
+    return token;
+}
+
+static inline TokenType compact_token_type(const CompactToken *token) {
+    return (TokenType) token->type;
+}
+
+static inline long long compact_token_offset(const CompactToken *token) {
+    return (long long) token->offset_low | (long long) token->offset_high << 32;
+}
+
+static inline long long compact_token_length(const CompactToken *token) {
+    return token->length;
+}
+
+bool tokenizer_lines_build(TokenizerLines *lines, const char *content, long long length);
+
+// Converts a byte offset into a 1-based line and column.
+void tokenizer_lines_locate(const TokenizerLines *lines, long long offset, long long *line, long long *column);
+
+void tokenizer_lines_free(TokenizerLines *lines);
+
+// Lexes the remaining input of the context into the list. No memory is allocated per token.
+bool tokenizer_collect(TokenizerContext *context, CompactTokenList *list);
+
+// Returns the line and column of a collected token, building the line table on first use.
+bool compact_tokens_locate(CompactTokenList *list, const TokenizerContext *context, long long index,
+                           long long *line, long long *column);
+
+void compact_tokens_free(CompactTokenList *list);
+
+#endif //COMPACT_TOKEN_H
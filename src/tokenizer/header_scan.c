@@ -0,0 +1,256 @@
+#include "header_scan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HEADER_READ_SIZE 4096
+
+typedef enum {
+    HEADER_DECLARATION,
+    HEADER_PATH_START,
+    HEADER_PATH_IDENTIFIER,
+    HEADER_PATH_DOT
+} HeaderState;
+
+typedef struct {
+    char *data;
+    long long length;
+    long long capacity;
+} HeaderPath;
+
+static bool path_append(HeaderPath *path, const char *content, const long long length) {
+    if (path->length + length + 1 > path->capacity) {
+        long long capacity = path->capacity ? path->capacity * 2 : 64;
+        while (capacity < path->length + length + 1) {
+            capacity *= 2;
+        }
+
+        char *data = realloc(path->data, capacity);
+        if (!data) {
+            return false;
+        }
+
+        path->data = data;
+        path->capacity = capacity;
+    }
+
+    memcpy(path->data + path->length, content, length);
+    path->length += length;
+    path->data[path->length] = '\0';
+    return true;
+}
+
+static bool commit_path(TokenizerHeader *header, HeaderPath *path, const bool package) {
+    char *value = strdup(path->data);
+    if (!value) {
+        return false;
+    }
+
+    path->length = 0;
+
+    if (package) {
+        header->package = value;
+        return true;
+    }
+
+    char **imports = realloc(header->imports, (header->imports_count + 1) * sizeof(char *));
+    if (!imports) {
+        free(value);
+        return false;
+    }
+
+    header->imports = imports;
+    header->imports[header->imports_count++] = value;
+    return true;
+}
+
+// Returns false when memory runs out. `truncated` is set when the header may continue
+// past the end of a partial buffer.
+static bool parse_header(const char *content, const long long length, const bool complete, TokenizerHeader *header,
+                         bool *truncated) {
+    TokenizerContext context;
+    memset(&context, 0, sizeof(context));
+    context.content = (char *) content;
+    context.content_length = length;
+    context.line = 1;
+    context.column = 1;
+
+    HeaderPath path = {NULL, 0, 0};
+    HeaderState state = HEADER_DECLARATION;
+    bool package = false;
+    bool done = false;
+    bool stored = true;
+    *truncated = false;
+
+    error.message = NULL;
+
+    TokenType type;
+    while (!done && stored && tokenizer_scan(&context, &type)) {
+        if (!complete && context.offset >= length) {
+            *truncated = true;
+            break;
+        }
+
+        const char *text = &content[context.frame.offset];
+        const long long text_length = context.offset - context.frame.offset;
+
+        switch (state) {
+            case HEADER_DECLARATION:
+                if (type == SEMI) {
+                    break;
+                }
+
+                if ((type == PACKAGE && !header->package && header->imports_count == 0) || type == IMPORT) {
+                    package = type == PACKAGE;
+                    state = HEADER_PATH_START;
+                    break;
+                }
+
+                done = true;
+                break;
+            case HEADER_PATH_START:
+            case HEADER_PATH_DOT:
+                if (type == IDENTIFIER) {
+                    stored = path_append(&path, text, text_length);
+                    state = HEADER_PATH_IDENTIFIER;
+                    break;
+                }
+
+                if (type == MULTIPLY && state == HEADER_PATH_DOT) {
+                    stored = path_append(&path, text, text_length) && commit_path(header, &path, package);
+                    state = HEADER_DECLARATION;
+                    break;
+                }
+
+                done = true;
+                break;
+            case HEADER_PATH_IDENTIFIER:
+                if (type == DOT) {
+                    stored = path_append(&path, text, text_length);
+                    state = HEADER_PATH_DOT;
+                    break;
+                }
+
+                stored = commit_path(header, &path, package);
+                state = HEADER_DECLARATION;
+
+                if (type == SEMI) {
+                    break;
+                }
+
+                if (type == IMPORT) {
+                    package = false;
+                    state = HEADER_PATH_START;
+                    break;
+                }
+
+                done = true;
+                break;
+        }
+    }
+
+    if (!done && stored && !*truncated) {
+        if (!complete) {
+            *truncated = true;
+        } else if (state == HEADER_PATH_IDENTIFIER) {
+            stored = commit_path(header, &path, package);
+        }
+    }
+
+    if (!*truncated && error.message && state != HEADER_DECLARATION) {
+        header->error = error;
+    }
+
+    error.message = NULL;
+    free(path.data);
+    return stored;
+}
+
+bool tokenizer_scan_header_string(const char *content, const long long length, TokenizerHeader *header) {
+    memset(header, 0, sizeof(*header));
+
+    bool truncated;
+    if (!parse_header(content, length, true, header, &truncated)) {
+        tokenizer_header_free(header);
+        return false;
+    }
+
+    return true;
+}
+
+bool tokenizer_scan_header(const char *filename, TokenizerHeader *header) {
+    memset(header, 0, sizeof(*header));
+
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    long long capacity = HEADER_READ_SIZE;
+    long long length = 0;
+    bool complete = false;
+
+    char *buffer = malloc(capacity);
+    if (!buffer) {
+        close(fd);
+        return false;
+    }
+
+    for (;;) {
+        while (length < capacity) {
+            const ssize_t count = read(fd, buffer + length, capacity - length);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count < 0) {
+                free(buffer);
+                close(fd);
+                return false;
+            }
+            if (count == 0) {
+                complete = true;
+                break;
+            }
+
+            length += count;
+        }
+
+        bool truncated;
+        const bool parsed = parse_header(buffer, length, complete, header, &truncated);
+        if (parsed && !truncated) {
+            break;
+        }
+
+        tokenizer_header_free(header);
+        if (!parsed) {
+            free(buffer);
+            close(fd);
+            return false;
+        }
+
+        capacity *= 2;
+        char *grown = realloc(buffer, capacity);
+        if (!grown) {
+            free(buffer);
+            close(fd);
+            return false;
+        }
+        buffer = grown;
+    }
+
+    free(buffer);
+    close(fd);
+    return true;
+}
+
+void tokenizer_header_free(TokenizerHeader *header) {
+    free(header->package);
+    for (int i = 0; i < header->imports_count; i++) {
+        free(header->imports[i]);
+    }
+    free(header->imports);
+    memset(header, 0, sizeof(*header));
+}
@@ -0,0 +1,24 @@
+#ifndef HEADER_SCAN_H
+#define HEADER_SCAN_H
+
+#include "tokenizer.h"
+
+typedef struct {
+    char *package;
+    char **imports;
+    int imports_count;
+    TokenizerError error;
+} TokenizerHeader;
+
+// Extracts the `package` and `import` declarations at the top of a file. Only the
+// first pages of the file are read, and lexing stops at the first token that cannot
+// belong to the header. Returns false if the file cannot be read or memory runs out.
+bool tokenizer_scan_header(const char *filename, TokenizerHeader *header);
+
+// Same as tokenizer_scan_header for a source already in memory; fails only when memory
+// runs out.
+bool tokenizer_scan_header_string(const char *content, long long length, TokenizerHeader *header);
+
+void tokenizer_header_free(TokenizerHeader *header);
+
+#endif //HEADER_SCAN_H
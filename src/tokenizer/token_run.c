@@ -0,0 +1,22 @@
+#include "token_run.h"
+
+bool tokenizer_run(TokenizerContext *context, const TokenHandlers *handlers, void *user) {
+    const TokenHandler table[] = {
+        [TOKEN_CATEGORY_OPERATOR] = handlers->operator,
+        [TOKEN_CATEGORY_KEYWORD] = handlers->keyword,
+        [TOKEN_CATEGORY_IDENTIFIER] = handlers->identifier,
+        [TOKEN_CATEGORY_NUMBER] = handlers->number,
+        [TOKEN_CATEGORY_STRING] = handlers->string,
+        [TOKEN_CATEGORY_ERROR] = handlers->error,
+    };
+
+    TokenType type;
+    while (tokenizer_scan(context, &type)) {
+        const TokenHandler handler = table[token_category(type)];
+        if (handler && !handler(user, type, token_view(context))) {
+            return false;
+        }
+    }
+
+    return !error.message;
+}
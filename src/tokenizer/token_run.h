@@ -0,0 +1,107 @@
+#ifndef TOKEN_RUN_H
+#define TOKEN_RUN_H
+
+#include <stdbool.h>
+
+#include "tokenizer.h"
+
+typedef enum {
+    TOKEN_CATEGORY_OPERATOR,
+    TOKEN_CATEGORY_KEYWORD,
+    TOKEN_CATEGORY_IDENTIFIER,
+    TOKEN_CATEGORY_NUMBER,
+    TOKEN_CATEGORY_STRING,
+    TOKEN_CATEGORY_ERROR
+} TokenCategory;
+
+// A token's text inside the source. Not NUL-terminated, valid as long as the source is.
+typedef struct {
+    const char *text;
+    long long length;
+    long long offset;
+    long long line;
+    long long column;
+} TokenView;
+
+// Returning false stops the run.
+typedef bool (*TokenHandler)(void *user, TokenType type, TokenView view);
+
+// Punctuation and operators, keywords (`is` and `as` included), identifiers, numeric
+// literals, char and string literals, and ERROR tokens in recovery mode. Tokens whose
+// handler is NULL are scanned past.
+typedef struct {
+    TokenHandler identifier;
+    TokenHandler keyword;
+    TokenHandler number;
+    TokenHandler string;
+    TokenHandler operator;
+    TokenHandler error;
+} TokenHandlers;
+
+static inline TokenCategory token_category(const TokenType type) {
+    if (type < IS) {
+        return TOKEN_CATEGORY_OPERATOR;
+    }
+    if (type < IDENTIFIER) {
+        return TOKEN_CATEGORY_KEYWORD;
+    }
+    if (type == IDENTIFIER) {
+        return TOKEN_CATEGORY_IDENTIFIER;
+    }
+    if (type < CHAR_LITERAL) {
+        return TOKEN_CATEGORY_NUMBER;
+    }
+    return type == ERROR ? TOKEN_CATEGORY_ERROR : TOKEN_CATEGORY_STRING;
+}
+
+static inline TokenView token_view(const TokenizerContext *context) {
+    const TokenView view = {
+        context->content + context->frame.offset,
+        context->offset - context->frame.offset,
+        context->frame.offset,
+        context->frame.line,
+        context->frame.column
+    };
+
+    return view;
+}
+
+// Lexes the remaining input, handing every token to the handler of its category. No
+// token is allocated. Returns false if a handler stopped the run or lexing failed (the
+// global error is set then). Must not be mixed with pending lookahead.
+bool tokenizer_run(TokenizerContext *context, const TokenHandlers *handlers, void *user);
+
+// Handler for the macro below that accepts a category without doing anything.
+static inline bool token_ignore(void *user, const TokenType type, const TokenView view) {
+    (void) user;
+    (void) type;
+    (void) view;
+    return true;
+}
+
+// Defines `static bool name(TokenizerContext *context, void *user)` behaving like
+// tokenizer_run with fixed handlers. They are called directly rather than through
+// pointers, so static inline handlers are compiled into the loop itself; pass
+// token_ignore for categories of no interest.
+#define TOKENIZER_DEFINE_RUN(name, on_identifier, on_keyword, on_number, on_string, on_operator, on_error) \
+    static bool name(TokenizerContext *context, void *user) {                                            \
+        TokenType type;                                                                                  \
+        while (tokenizer_scan(context, &type)) {                                                         \
+            const TokenView view = token_view(context);                                                  \
+            bool more;                                                                                   \
+            switch (token_category(type)) {                                                              \
+                case TOKEN_CATEGORY_IDENTIFIER: more = on_identifier(user, type, view); break;           \
+                case TOKEN_CATEGORY_KEYWORD: more = on_keyword(user, type, view); break;                 \
+                case TOKEN_CATEGORY_NUMBER: more = on_number(user, type, view); break;                   \
+                case TOKEN_CATEGORY_STRING: more = on_string(user, type, view); break;                   \
+                case TOKEN_CATEGORY_OPERATOR: more = on_operator(user, type, view); break;                \
+                default: more = on_error(user, type, view); break;                                       \
+            }                                                                                            \
+            if (!more) {                                                                                 \
+                return false;                                                                            \
+            }                                                                                            \
+        }                                                                                                \
+        return !error.message;                                                                           \
+    }
+
+#endif //TOKEN_RUN_H
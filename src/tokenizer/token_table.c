@@ -0,0 +1,251 @@
+#include "token_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool token_table_build(TokenTable *table, TokenizerContext *context) {
+    memset(table, 0, sizeof(*table));
+
+    CompactTokenList list = {0};
+    if (!tokenizer_collect(context, &list)
+        || !tokenizer_lines_build(&table->lines, context->content, context->content_length)) {
+        compact_tokens_free(&list);
+        return false;
+    }
+
+    // Shrink to the exact size so the table is one tight contiguous block.
+    if (list.count) {
+        CompactToken *tokens = realloc(list.tokens, list.count * sizeof(CompactToken));
+        table->tokens = tokens ? tokens : list.tokens;
+    } else {
+        free(list.tokens);
+    }
+    table->count = list.count;
+
+    return true;
+}
+
+void token_table_free(TokenTable *table) {
+    free(table->tokens);
+    tokenizer_lines_free(&table->lines);
+    memset(table, 0, sizeof(*table));
+}
+
+// The only lexer state carried from one token to the next is the previous token's
+// type, which decides whether a '-' is unary. Position aside, two tokens with the
+// same predecessor type therefore continue identically.
+static TokenType previous_type(const CompactToken *tokens, const long long index) {
+    return index > 0 ? compact_token_type(&tokens[index - 1]) : LEFT_PARENT;
+}
+
+static long long token_end(const CompactToken *token) {
+    return compact_token_offset(token) + compact_token_length(token);
+}
+
+static long long first_line_after(const TokenizerLines *lines, const long long offset) {
+    long long low = 0;
+    long long high = lines->count;
+
+    while (low < high) {
+        const long long middle = low + (high - low) / 2;
+
+        if (lines->starts[middle] <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static bool append(CompactTokenList *list, const TokenType type, const long long offset, const long long length) {
+    if (offset > COMPACT_TOKEN_MAX_OFFSET || length > UINT32_MAX) {
+        return false;
+    }
+
+    if (list->count == list->capacity) {
+        const long long capacity = list->capacity ? list->capacity * 2 : 64;
+        CompactToken *tokens = realloc(list->tokens, capacity * sizeof(CompactToken));
+        if (!tokens) {
+            return false;
+        }
+
+        list->tokens = tokens;
+        list->capacity = capacity;
+    }
+
+    list->tokens[list->count++] = compact_token_make(type, offset, length);
+    return true;
+}
+
+bool token_table_edit(TokenTable *table, TokenizerContext *context, const long long offset, const long long deleted,
+                      const long long inserted) {
+    const long long delta = inserted - deleted;
+    if (context->filtered || offset < 0 || deleted < 0 || inserted < 0
+        || offset + inserted > context->content_length) {
+        return false;
+    }
+
+    // Finishing a token may peek one byte past its end, so a token ending right in
+    // front of the edit is rescanned as well.
+    const long long first = token_table_seek(table, offset - 2);
+    const long long restart = first ? token_end(&table->tokens[first - 1]) : 0;
+
+    TokenizerCheckpoint start = {restart, 1, 1, previous_type(table->tokens, first)};
+    tokenizer_lines_locate(&table->lines, restart, &start.line, &start.column);
+
+    long long old = first;
+    while (old < table->count && compact_token_offset(&table->tokens[old]) < offset + deleted) {
+        old++;
+    }
+
+    // Relex until a new token starts where a surviving old one now sits and follows
+    // the same token type. An unterminated block comment opened by the edit, or string
+    // without recovery, never lines up and simply runs on to the end of the input.
+    CompactTokenList fresh = {0};
+    TokenType previous = start.type;
+    TokenType type;
+    long long resume = table->count;
+
+    tokenizer_restore(context, &start);
+
+    while (tokenizer_scan(context, &type)) {
+        const long long position = context->frame.offset;
+
+        if (position >= offset + inserted) {
+            while (old < table->count && compact_token_offset(&table->tokens[old]) + delta < position) {
+                old++;
+            }
+
+            if (old < table->count && compact_token_offset(&table->tokens[old]) + delta == position
+                && previous_type(table->tokens, old) == previous) {
+                resume = old;
+                break;
+            }
+        }
+
+        if (!append(&fresh, type, position, context->offset - position)) {
+            free(fresh.tokens);
+            return false;
+        }
+        previous = type;
+    }
+
+    // Grow both arrays before touching anything so a failed allocation leaves the
+    // table as it was.
+    const long long kept = table->count - resume;
+    const long long count = first + fresh.count + kept;
+    if (count > table->count) {
+        CompactToken *tokens = realloc(table->tokens, count * sizeof(CompactToken));
+        if (!tokens) {
+            free(fresh.tokens);
+            return false;
+        }
+        table->tokens = tokens;
+    }
+
+    const long long line_keep = first_line_after(&table->lines, offset);
+    const long long line_tail = first_line_after(&table->lines, offset + deleted);
+    long long line_added = 0;
+    for (long long i = offset; i < offset + inserted; i++) {
+        line_added += context->content[i] == '\n';
+    }
+
+    const long long line_count = line_keep + line_added + table->lines.count - line_tail;
+    if (line_count > table->lines.count) {
+        long long *starts = realloc(table->lines.starts, line_count * sizeof(long long));
+        if (!starts) {
+            free(fresh.tokens);
+            return false;
+        }
+        table->lines.starts = starts;
+    }
+
+    CompactToken *tail = table->tokens + first + fresh.count;
+    memmove(tail, table->tokens + resume, kept * sizeof(CompactToken));
+    for (long long i = 0; i < kept; i++) {
+        tail[i] = compact_token_make(compact_token_type(&tail[i]), compact_token_offset(&tail[i]) + delta,
+                                     compact_token_length(&tail[i]));
+    }
+    if (fresh.count) {
+        memcpy(table->tokens + first, fresh.tokens, fresh.count * sizeof(CompactToken));
+    }
+    table->count = count;
+    free(fresh.tokens);
+
+    long long *starts = table->lines.starts;
+    memmove(starts + line_keep + line_added, starts + line_tail,
+            (table->lines.count - line_tail) * sizeof(long long));
+    for (long long i = line_keep + line_added; i < line_count; i++) {
+        starts[i] += delta;
+    }
+    for (long long i = offset, line = line_keep; i < offset + inserted; i++) {
+        if (context->content[i] == '\n') {
+            starts[line++] = i + 1;
+        }
+    }
+    table->lines.count = line_count;
+
+    return true;
+}
+
+long long token_table_seek(const TokenTable *table, const long long offset) {
+    long long low = 0;
+    long long high = table->count;
+
+    while (low < high) {
+        const long long middle = low + (high - low) / 2;
+        const CompactToken *token = &table->tokens[middle];
+
+        if (compact_token_offset(token) + compact_token_length(token) <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+long long token_table_at(const TokenTable *table, const long long offset) {
+    const long long index = token_table_seek(table, offset);
+    if (index == table->count || compact_token_offset(&table->tokens[index]) > offset) {
+        return -1;
+    }
+
+    return index;
+}
+
+long long token_table_range(const TokenTable *table, const long long start, const long long end, long long *first) {
+    *first = token_table_seek(table, start);
+    if (end <= start) {
+        return 0;
+    }
+
+    long long low = *first;
+    long long high = table->count;
+    while (low < high) {
+        const long long middle = low + (high - low) / 2;
+
+        if (compact_token_offset(&table->tokens[middle]) < end) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low - *first;
+}
+
+long long token_table_next(const TokenTable *table, const long long index) {
+    return index + 1 < table->count ? index + 1 : -1;
+}
+
+long long token_table_previous(const TokenTable *table, const long long index) {
+    return index > 0 && index <= table->count ? index - 1 : -1;
+}
+
+void token_table_locate(const TokenTable *table, const long long index, long long *line, long long *column) {
+    tokenizer_lines_locate(&table->lines, compact_token_offset(&table->tokens[index]), line, column);
+}
@@ -0,0 +1,54 @@
+#ifndef TOKEN_TABLE_H
+#define TOKEN_TABLE_H
+
+#include <stdbool.h>
+
+#include "compact_token.h"
+
+// Materialized tokens of one source in offset order, with the line table built up
+// front. Queries never modify the table, so they can run concurrently from any number
+// of threads without locking as long as no token_table_edit is in progress.
+typedef struct {
+    CompactToken *tokens;
+    long long count;
+    TokenizerLines lines;
+} TokenTable;
+
+// Lexes the remaining input of the context into the table.
+bool token_table_build(TokenTable *table, TokenizerContext *context);
+
+void token_table_free(TokenTable *table);
+
+// Brings the table up to date after `deleted` bytes at `offset` were replaced by
+// `inserted` new ones. The context must hold the complete edited source (e.g. via
+// tokenizer_reset) and use the same recovery mode the table was built with; filtered
+// contexts are rejected. Lexing restarts shortly before the edit and stops as soon as
+// a token lines up with an old one at the same shifted position and lexer state, so
+// later tokens are only moved, never rescanned. On failure the table is unchanged.
+bool token_table_edit(TokenTable *table, TokenizerContext *context, long long offset, long long deleted,
+                      long long inserted);
+
+static inline const CompactToken *token_table_get(const TokenTable *table, const long long index) {
+    return index >= 0 && index < table->count ? &table->tokens[index] : NULL;
+}
+
+// Index of the token containing byte `offset`, or -1 when it falls in whitespace, a
+// comment or outside the source.
+long long token_table_at(const TokenTable *table, long long offset);
+
+// Index of the first token ending after `offset`, i.e. the token at or following it.
+// Returns table->count when there is none.
+long long token_table_seek(const TokenTable *table, long long offset);
+
+// Number of tokens overlapping [start, end); the first one's index is stored in `first`.
+long long token_table_range(const TokenTable *table, long long start, long long end, long long *first);
+
+// Neighbor navigation; both return -1 past either end.
+long long token_table_next(const TokenTable *table, long long index);
+
+long long token_table_previous(const TokenTable *table, long long index);
+
+// 1-based line and column of a token.
+void token_table_locate(const TokenTable *table, long long index, long long *line, long long *column);
+
+#endif //TOKEN_TABLE_H
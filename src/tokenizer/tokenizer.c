@@ -1,9 +1,14 @@
 #include "tokenizer.h"
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+
+#include "../io/byte_codec.h"
 
 #define is_number(c) (c >= '0' && c <= '9')
 #define is_identifier_start(c) ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$')
@@ -11,7 +16,16 @@
 #define is_number_bin(c) (c == '0' || c == '1')
 #define is_number_hex(c) (is_number(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))
 
-TokenizerError error;
+#define FINGERPRINT_SEED_1 0x243F6A8885A308D3ULL
+#define FINGERPRINT_SEED_2 0x13198A2E03707344ULL
+#define FINGERPRINT_PRIME_1 0x9E3779B185EBCA87ULL
+#define FINGERPRINT_PRIME_2 0xC2B2AE3D27D4EB4FULL
+
+#define CHECKPOINT_MAGIC "AXCK"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_RECORD_SIZE 28
+
+_Thread_local TokenizerError error;
 
 static TokenizerFrame collect_frame(const TokenizerContext *context) {
     const TokenizerFrame frame = {
@@ -23,8 +37,35 @@ static TokenizerFrame collect_frame(const TokenizerContext *context) {
     return frame;
 }
 
+static void append_diagnostic(TokenizerContext *context, char *message, const TokenizerFrame frame) {
+    if (context->errors_count == context->errors_capacity) {
+        const int capacity = context->errors_capacity ? context->errors_capacity * 2 : 16;
+        TokenizerError *errors = realloc(context->errors, capacity * sizeof(TokenizerError));
+        if (!errors) {
+            return;
+        }
+
+        context->errors = errors;
+        context->errors_capacity = capacity;
+    }
+
+    context->errors[context->errors_count].message = message;
+    context->errors[context->errors_count].frame = frame;
+    context->errors_count++;
+}
+
+static void report_error(TokenizerContext *context, char *message, const TokenizerFrame frame) {
+    if (!context->recover) {
+        error.message = message;
+        error.frame = frame;
+        return;
+    }
+
+    append_diagnostic(context, message, frame);
+}
+
 static char peek_n(const TokenizerContext *context, const int n) {
-    const int offset = context->offset + n;
+    const long long offset = context->offset + n;
 
     if (offset >= context->content_length)
         return '\0';
@@ -36,8 +77,13 @@ static char peek(const TokenizerContext *context) {
     return peek_n(context, 0);
 }
 
+// Stays put at the end of input, so a literal that runs out of content can never
+// leave the cursor (and the token built from it) past the last byte.
 static char next(TokenizerContext *context) {
-    const char result = peek(context);
+    if (context->offset >= context->content_length)
+        return '\0';
+
+    const char result = context->content[context->offset];
 
     if (result == '\n') {
         context->line++;
@@ -70,8 +116,7 @@ static void skip_multi_comment(TokenizerContext *context) {
 
     while (peek_n(context, 0) != '*' || peek_n(context, 1) != '/') {
         if (context->offset >= context->content_length) {
-            error.message = "unterminated comment";
-            error.frame = frame;
+            report_error(context, "unterminated comment", frame);
             return;
         }
 
@@ -94,6 +139,142 @@ static void skip(TokenizerContext *context) {
     }
 }
 
+static long long trivia_at(const TokenizerContext *context, const long long offset, TriviaKind *kind,
+                           bool *terminated) {
+    const char *content = context->content;
+    const long long length = context->content_length;
+    long long end = offset;
+
+    *terminated = true;
+    if (offset >= length) {
+        return 0;
+    }
+
+    switch (content[offset]) {
+        case ' ':
+        case '\t':
+        case '\r':
+            if (content[offset] == '\r' && offset + 1 < length && content[offset + 1] == '\n') {
+                *kind = TRIVIA_NEWLINE;
+                return 2;
+            }
+
+            while (end < length && (content[end] == ' ' || content[end] == '\t'
+                                    || (content[end] == '\r' && (end + 1 >= length || content[end + 1] != '\n')))) {
+                end++;
+            }
+
+            *kind = TRIVIA_WHITESPACE;
+            return end - offset;
+        case '\n':
+            *kind = TRIVIA_NEWLINE;
+            return 1;
+        case '/':
+            if (offset + 1 >= length) {
+                return 0;
+            }
+
+            if (content[offset + 1] == '/') {
+                end = offset + 2;
+                while (end < length && content[end] != '\r' && content[end] != '\n') {
+                    end++;
+                }
+
+                *kind = TRIVIA_LINE_COMMENT;
+                return end - offset;
+            }
+
+            if (content[offset + 1] == '*') {
+                end = offset + 2;
+                while (end + 1 < length && (content[end] != '*' || content[end + 1] != '/')) {
+                    end++;
+                }
+
+                *kind = TRIVIA_BLOCK_COMMENT;
+                if (end + 1 >= length) {
+                    *terminated = false;
+                    return length - offset;
+                }
+
+                return end + 2 - offset;
+            }
+
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+static void append_trivia(TokenizerContext *context, const TriviaKind kind, const long long offset,
+                          const long long length) {
+    if (context->trivia_count == context->trivia_capacity) {
+        const long long capacity = context->trivia_capacity ? context->trivia_capacity * 2 : 256;
+        Trivia *trivia = realloc(context->trivia, capacity * sizeof(Trivia));
+        if (!trivia) {
+            return;
+        }
+
+        context->trivia = trivia;
+        context->trivia_capacity = capacity;
+    }
+
+    context->trivia[context->trivia_count].kind = kind;
+    context->trivia[context->trivia_count].offset = offset;
+    context->trivia[context->trivia_count].length = length;
+    context->trivia_count++;
+}
+
+static void skip_leading_trivia(TokenizerContext *context) {
+    context->leading.first = context->trivia_count;
+
+    for (;;) {
+        TriviaKind kind;
+        bool terminated;
+        const long long length = trivia_at(context, context->offset, &kind, &terminated);
+        if (length == 0) {
+            break;
+        }
+
+        if (!terminated) {
+            report_error(context, "unterminated comment", collect_frame(context));
+        }
+
+        if (context->offset >= context->trailing_end) {
+            append_trivia(context, kind, context->offset, length);
+        }
+
+        for (long long i = 0; i < length; i++) {
+            next(context);
+        }
+    }
+
+    context->leading.count = context->trivia_count - context->leading.first;
+}
+
+static void collect_trailing_trivia(TokenizerContext *context) {
+    long long offset = context->offset;
+    context->trailing.first = context->trivia_count;
+
+    for (;;) {
+        TriviaKind kind;
+        bool terminated;
+        const long long length = trivia_at(context, offset, &kind, &terminated);
+        if (length == 0 || !terminated) {
+            break;
+        }
+
+        append_trivia(context, kind, offset, length);
+        offset += length;
+
+        if (kind == TRIVIA_NEWLINE) {
+            break;
+        }
+    }
+
+    context->trailing.count = context->trivia_count - context->trailing.first;
+    context->trailing_end = offset;
+}
+
 static char* slice(const TokenizerContext *context) {
     char *content = malloc(context->offset - context->frame.offset + 1);
 
@@ -102,33 +283,44 @@ static char* slice(const TokenizerContext *context) {
     return content;
 }
 
+// The words lexed as keywords. Unlike the header's `keywords` table this leaves out
+// `and`, `or` and `not`: those tokens are only ever spelled `&&`, `||` and `!`.
+static const KeywordEntry identifier_keywords[] = {
+    {"is", IS},
+    {"as", AS},
+    {"package", PACKAGE},
+    {"import", IMPORT},
+    {"struct", STRUCT},
+    {"fn", FN},
+    {"return", RETURN},
+    {"var", VAR},
+    {"val", VAL},
+    {"if", IF},
+    {"else", ELSE},
+    {"for", FOR},
+    {"do", DO},
+    {"while", WHILE},
+    {"continue", CONTINUE},
+    {"break", BREAK},
+    {"this", THIS},
+    {"true", TRUE},
+    {"false", FALSE},
+};
+
 static TokenType tokenize_identifier(TokenizerContext *context) {
     do {
         next(context);
     } while (is_identifier(peek(context)));
 
-    const char *content = slice(context);
-
-    if (strcmp(content, "is") == 0) return IS;
-    if (strcmp(content, "as") == 0) return AS;
-    if (strcmp(content, "package") == 0) return PACKAGE;
-    if (strcmp(content, "import") == 0) return IMPORT;
-    if (strcmp(content, "struct") == 0) return STRUCT;
-    if (strcmp(content, "fn") == 0) return FN;
-    if (strcmp(content, "return") == 0) return RETURN;
-    if (strcmp(content, "var") == 0) return VAR;
-    if (strcmp(content, "val") == 0) return VAL;
-    if (strcmp(content, "if") == 0) return IF;
-    if (strcmp(content, "else") == 0) return ELSE;
-    if (strcmp(content, "for") == 0) return FOR;
-    if (strcmp(content, "do") == 0) return DO;
-    if (strcmp(content, "while") == 0) return WHILE;
-    if (strcmp(content, "continue") == 0) return CONTINUE;
-    if (strcmp(content, "break") == 0) return BREAK;
-    if (strcmp(content, "this") == 0) return THIS;
-    if (strcmp(content, "true") == 0) return TRUE;
-    if (strcmp(content, "false") == 0) return FALSE;
+    const char *content = &context->content[context->frame.offset];
+    const size_t length = context->offset - context->frame.offset;
 
+    for (size_t i = 0; i < sizeof(identifier_keywords) / sizeof(identifier_keywords[0]); i++) {
+        const KeywordEntry *entry = &identifier_keywords[i];
+        if (strlen(entry->keyword) == length && memcmp(entry->keyword, content, length) == 0) {
+            return entry->token;
+        }
+    }
 
     return IDENTIFIER;
 }
@@ -138,8 +330,7 @@ static bool tokenize_dec_part(TokenizerContext *context, const bool req) {
     bool has_number = false;
 
     if (peek(context) == '_') {
-        error.message = "numeric literal cannot have an underscore as it's first or last character";
-        error.frame = context->frame;
+        report_error(context, "numeric literal cannot have an underscore as it's first or last character", context->frame);
         return false;
     }
 
@@ -159,14 +350,12 @@ static bool tokenize_dec_part(TokenizerContext *context, const bool req) {
     }
 
     if (!has_number && req) {
-        error.message = "numeric literal cannot terminate with a dot";
-        error.frame = context->frame;
+        report_error(context, "numeric literal cannot terminate with a dot", context->frame);
         return false;
     }
 
     if (last_underscore) {
-        error.message = "numeric literal cannot have an underscore as it's last character";
-        error.frame = context->frame;
+        report_error(context, "numeric literal cannot have an underscore as it's last character", context->frame);
         return false;
     }
 
@@ -269,8 +458,7 @@ static bool tokenize_escape(TokenizerContext *context, const char allowed_char)
                     continue;
                 }
 
-                error.message = "invalid unicode";
-                error.frame = frame;
+                report_error(context, "invalid unicode", frame);
                 return false;
             }
 
@@ -278,30 +466,55 @@ static bool tokenize_escape(TokenizerContext *context, const char allowed_char)
         default:
     }
 
-    error.message = "invalid escape sequence";
-    error.frame = frame;
+    report_error(context, "invalid escape sequence", frame);
     return false;
 }
 
+// A string still open at the end of input was never meant to run that far. Rewinds to
+// the end of the line it started on, so recovery picks up from the next line, and drops
+// diagnostics from the part that will be lexed again.
+static void truncate_string(TokenizerContext *context, const int errors_count) {
+    context->offset = context->frame.offset;
+    context->line = context->frame.line;
+    context->column = context->frame.column;
+
+    while (peek(context) != '\r' && peek(context) != '\n' && context->offset < context->content_length) {
+        next(context);
+    }
+
+    int count = errors_count;
+    while (count < context->errors_count && context->errors[count].frame.offset < context->offset) {
+        count++;
+    }
+    context->errors_count = count;
+}
+
 static TokenType tokenize_string(TokenizerContext *context) {
+    const int errors_count = context->errors_count;
+    bool valid = true;
     next(context);
 
     while (peek(context) != '"') {
         if (context->offset >= context->content_length) {
-            error.message = "string literal is not completed";
-            error.frame = context->frame;
+            if (context->recover) {
+                truncate_string(context, errors_count);
+            }
+
+            report_error(context, "string literal is not completed", context->frame);
             return ERROR;
         }
 
         if (peek(context) == '\\') {
-            tokenize_escape(context, '"');
+            if (!tokenize_escape(context, '"')) {
+                valid = false;
+            }
         } else {
             next(context);
         }
     }
     next(context);
 
-    return STRING_LITERAL;
+    return valid ? STRING_LITERAL : ERROR;
 }
 
 static TokenType tokenize_char(TokenizerContext *context) {
@@ -316,8 +529,7 @@ static TokenType tokenize_char(TokenizerContext *context) {
     }
 
     if (next(context) != '\'') {
-        error.message = "symbol literal is not completed";
-        error.frame = context->frame;
+        report_error(context, "symbol literal is not completed", context->frame);
         return ERROR;
     }
 
@@ -479,56 +691,462 @@ static TokenType tokenize_operator(TokenizerContext *context) {
         default:
     }
 
-    error.message = "unknown operator";
-    error.frame = context->frame;
+    report_error(context, "unknown operator", context->frame);
     return ERROR;
 }
 
-Token *tokenizer_next(TokenizerContext *context) {
-    skip(context);
+static void resync(TokenizerContext *context, const char first) {
+    if (is_number(first) || first == '.') {
+        while (is_identifier(peek(context))) {
+            next(context);
+        }
+    } else if (first == '\'') {
+        while (peek(context) != '\'' && peek(context) != '\n' && peek(context) != '\0') {
+            next(context);
+        }
+
+        if (peek(context) == '\'') {
+            next(context);
+        }
+    }
+
+    if (context->offset == context->frame.offset) {
+        next(context);
+    }
+}
+
+static TokenizerCheckpoint collect_checkpoint(const TokenizerContext *context) {
+    const TokenizerCheckpoint checkpoint = {
+        context->offset,
+        context->line,
+        context->column,
+        context->type
+    };
+
+    return checkpoint;
+}
+
+static void record_checkpoint(TokenizerContext *context) {
+    if (context->checkpoints_count > 0
+        && context->checkpoints[context->checkpoints_count - 1].offset >= context->offset) {
+        return;
+    }
+
+    if (context->checkpoints_count == context->checkpoints_capacity) {
+        const int capacity = context->checkpoints_capacity ? context->checkpoints_capacity * 2 : 16;
+        TokenizerCheckpoint *checkpoints = realloc(context->checkpoints, capacity * sizeof(TokenizerCheckpoint));
+        if (!checkpoints) {
+            return;
+        }
+
+        context->checkpoints = checkpoints;
+        context->checkpoints_capacity = capacity;
+    }
+
+    context->checkpoints[context->checkpoints_count++] = collect_checkpoint(context);
+}
+
+static uint64_t rotate_left(const uint64_t value, const int bits) {
+    return value << bits | value >> (64 - bits);
+}
+
+static void fingerprint_word(TokenizerContext *context, const uint64_t word) {
+    context->fingerprint[0] = rotate_left(context->fingerprint[0] ^ word * FINGERPRINT_PRIME_1, 31) * FINGERPRINT_PRIME_2;
+    context->fingerprint[1] = rotate_left(context->fingerprint[1] + word * FINGERPRINT_PRIME_2, 29) * FINGERPRINT_PRIME_1;
+}
+
+static void fingerprint_token(TokenizerContext *context, const TokenType type) {
+    const char *content = &context->content[context->frame.offset];
+    const long long length = context->offset - context->frame.offset;
+
+    fingerprint_word(context, (uint64_t) type << 48 ^ (uint64_t) length);
+
+    // Words are read as little-endian so a fingerprint does not depend on the host.
+    const unsigned char *bytes = (const unsigned char *) content;
+    long long i = 0;
+    for (; i + 8 <= length; i += 8) {
+        fingerprint_word(context, read_u64(bytes + i));
+    }
+
+    if (i < length) {
+        uint64_t word = 0;
+        for (long long j = 0; i + j < length; j++) {
+            word |= (uint64_t) bytes[i + j] << (8 * j);
+        }
+        fingerprint_word(context, word);
+    }
+}
+
+static uint64_t fingerprint_finish(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static TokenType closer_of(const TokenType type) {
+    switch (type) {
+        case LEFT_PARENT: return RIGHT_PARENT;
+        case LEFT_BRACE: return RIGHT_BRACE;
+        case LEFT_SQUARE: return RIGHT_SQUARE;
+        default: return ERROR;
+    }
+}
+
+static bool push_match(TokenizerContext *context, const long long index) {
+    if (context->bracket_match_count == context->bracket_match_capacity) {
+        const long long capacity = context->bracket_match_capacity ? context->bracket_match_capacity * 2 : 256;
+        TokenizerBracketMatch *matches = realloc(context->bracket_match, capacity * sizeof(TokenizerBracketMatch));
+        if (!matches) {
+            return false;
+        }
+
+        context->bracket_match = matches;
+        context->bracket_match_capacity = capacity;
+    }
+
+    context->bracket_match[context->bracket_match_count++] = (TokenizerBracketMatch) {index, -1};
+    return true;
+}
+
+// Mismatches are only diagnostics in recovery mode, like every other lexing error there.
+static void bracket_diagnostic(TokenizerContext *context, char *message, const TokenizerFrame frame) {
+    if (context->recover) {
+        append_diagnostic(context, message, frame);
+    }
+}
+
+static void track_bracket(TokenizerContext *context, const TokenType type) {
+    const bool closing = type == RIGHT_PARENT || type == RIGHT_BRACE || type == RIGHT_SQUARE;
+    if (!closing && closer_of(type) == ERROR) {
+        return;
+    }
+
+    const long long match = context->bracket_match_count;
+    if (!push_match(context, context->token_index)) {
+        return;
+    }
+
+    if (!closing) {
+        if (context->bracket_stack_count == context->bracket_stack_capacity) {
+            const long long capacity = context->bracket_stack_capacity ? context->bracket_stack_capacity * 2 : 64;
+            TokenizerBracket *stack = realloc(context->bracket_stack, capacity * sizeof(TokenizerBracket));
+            if (!stack) {
+                return;
+            }
+
+            context->bracket_stack = stack;
+            context->bracket_stack_capacity = capacity;
+        }
+
+        const TokenizerBracket bracket = {match, type, context->frame};
+        context->bracket_stack[context->bracket_stack_count++] = bracket;
+        return;
+    }
+
+    long long depth = context->bracket_stack_count - 1;
+    while (depth >= 0 && closer_of(context->bracket_stack[depth].type) != type) {
+        depth--;
+    }
+
+    if (depth < 0) {
+        bracket_diagnostic(context, "unmatched closing bracket", context->frame);
+        return;
+    }
+
+    while (context->bracket_stack_count - 1 > depth) {
+        bracket_diagnostic(context, "unclosed bracket", context->bracket_stack[--context->bracket_stack_count].frame);
+    }
+
+    TokenizerBracketMatch *opener = &context->bracket_match[context->bracket_stack[--context->bracket_stack_count].match];
+    TokenizerBracketMatch *closer = &context->bracket_match[match];
+    opener->match = closer->index;
+    closer->match = opener->index;
+}
+
+static void finish_brackets(TokenizerContext *context) {
+    for (long long i = 0; i < context->bracket_stack_count; i++) {
+        bracket_diagnostic(context, "unclosed bracket", context->bracket_stack[i].frame);
+    }
+
+    context->bracket_stack_count = 0;
+}
+
+static bool scan_token(TokenizerContext *context, TokenType *type) {
+    if (context->checkpoint_interval && context->offset >= context->checkpoint_next) {
+        record_checkpoint(context);
+        context->checkpoint_next = (context->offset / context->checkpoint_interval + 1) * context->checkpoint_interval;
+    }
+
+    if (context->trivia_mode) {
+        skip_leading_trivia(context);
+    } else {
+        skip(context);
+    }
 
     if (context->offset >= context->content_length || error.message) {
-        return NULL;
+        if (context->brackets_mode && context->offset >= context->content_length) {
+            finish_brackets(context);
+        }
+
+        return false;
     }
 
     context->frame = collect_frame(context);
 
-    TokenType type;
-
     const char first = peek(context);
     if (is_identifier_start(first)) {
-        type = tokenize_identifier(context);
+        *type = tokenize_identifier(context);
     } else if (is_number(first) || first == '.') {
-        type = tokenize_number(context);
+        *type = tokenize_number(context);
     } else if (first == '"') {
-        type = tokenize_string(context);
+        *type = tokenize_string(context);
     } else if (first == '\'') {
-        type = tokenize_char(context);
+        *type = tokenize_char(context);
     } else {
-        type = tokenize_operator(context);
+        *type = tokenize_operator(context);
     }
 
-    if (type == ERROR) {
-        return NULL;
+    if (*type == ERROR) {
+        if (!context->recover) {
+            return false;
+        }
+
+        resync(context, first);
     }
 
-    context->type = type;
+    if (context->fingerprinting) {
+        fingerprint_token(context, *type);
+    }
 
-    Token *token = malloc(sizeof(Token));
-    if (!token) {
-        return NULL;
+    if (context->brackets_mode) {
+        track_bracket(context, *type);
+    }
+
+    context->token_index++;
+
+    if (context->trivia_mode) {
+        collect_trailing_trivia(context);
     }
 
+    context->type = *type;
+    return true;
+}
+
+static bool is_selected(const TokenizerContext *context, const TokenType type) {
+    return type == ERROR || (context->filter[type / 8] >> (type % 8) & 1);
+}
+
+static bool scan(TokenizerContext *context, TokenType *type) {
+    do {
+        if (!scan_token(context, type)) {
+            return false;
+        }
+    } while (context->filtered && !is_selected(context, *type));
+
+    return true;
+}
+
+static void fill_token(const TokenizerContext *context, const TokenType type, Token *token) {
     token->type = type;
-    token->content = slice(context);
     token->offset = context->frame.offset;
     token->length = context->offset - context->frame.offset;
     token->line = context->frame.line;
     token->column = context->frame.column;
+}
+
+static void fill_extras(const TokenizerContext *context, TokenExtras *extras) {
+    if (context->trivia_mode || context->brackets_mode) {
+        *extras = (TokenExtras) {context->leading, context->trailing, context->token_index - 1};
+    }
+}
+
+static bool fill_slot(const TokenizerContext *context, const TokenType type, TokenizerSlot *slot) {
+    const long long length = context->offset - context->frame.offset;
+
+    if (slot->capacity < length + 1) {
+        char *content = realloc(slot->token.content, length + 1);
+        if (!content) {
+            return false;
+        }
+
+        slot->token.content = content;
+        slot->capacity = length + 1;
+    }
+
+    memcpy(slot->token.content, &context->content[context->frame.offset], length);
+    slot->token.content[length] = '\0';
+    fill_token(context, type, &slot->token);
+    fill_extras(context, &slot->extras);
+    return true;
+}
+
+static void fill_lookahead(TokenizerContext *context) {
+    while (context->lookahead_count < TOKENIZER_LOOKAHEAD) {
+        const int index = (context->lookahead_start + context->lookahead_count) % TOKENIZER_LOOKAHEAD;
+        const TokenizerCheckpoint start = collect_checkpoint(context);
+
+        TokenType type;
+        if (!scan(context, &type)) {
+            return;
+        }
+
+        if (!fill_slot(context, type, &context->lookahead[index])) {
+            return;
+        }
+
+        context->lookahead[index].start = start;
+
+        context->lookahead_count++;
+    }
+}
+
+Token *tokenizer_next(TokenizerContext *context) {
+    if (context->lookahead_count > 0) {
+        const Token *front = &context->lookahead[context->lookahead_start].token;
+
+        Token *token = malloc(sizeof(Token));
+        if (!token) {
+            return NULL;
+        }
+
+        *token = *front;
+        token->content = strdup(front->content);
+        context->current.extras = context->lookahead[context->lookahead_start].extras;
+
+        context->lookahead_start = (context->lookahead_start + 1) % TOKENIZER_LOOKAHEAD;
+        context->lookahead_count--;
+        return token;
+    }
+
+    TokenType type;
+    if (!scan(context, &type)) {
+        return NULL;
+    }
+
+    Token *token = malloc(sizeof(Token));
+    if (!token) {
+        return NULL;
+    }
+
+    fill_token(context, type, token);
+    fill_extras(context, &context->current.extras);
+    token->content = slice(context);
 
     return token;
 }
 
+bool tokenizer_scan(TokenizerContext *context, TokenType *type) {
+    return scan(context, type);
+}
+
+void tokenizer_recover(TokenizerContext *context, const bool recover) {
+    context->recover = recover;
+}
+
+void tokenizer_filter(TokenizerContext *context, const TokenType *types, const int count) {
+    memset(context->filter, 0, sizeof(context->filter));
+    context->filtered = count > 0;
+
+    for (int i = 0; i < count; i++) {
+        context->filter[types[i] / 8] |= 1 << (types[i] % 8);
+    }
+}
+
+void tokenizer_trivia(TokenizerContext *context, const bool enabled) {
+    context->trivia_mode = enabled;
+    context->leading.count = 0;
+    context->trailing.count = 0;
+    context->trailing_end = context->offset;
+}
+
+void tokenizer_brackets(TokenizerContext *context, const bool enabled) {
+    context->brackets_mode = enabled;
+    context->bracket_stack_count = 0;
+    context->bracket_match_count = 0;
+}
+
+long long tokenizer_bracket_match(const TokenizerContext *context, const long long token_index) {
+    long long low = 0;
+    long long high = context->bracket_match_count;
+
+    while (low < high) {
+        const long long middle = low + (high - low) / 2;
+        if (context->bracket_match[middle].index < token_index) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low < context->bracket_match_count && context->bracket_match[low].index == token_index
+               ? context->bracket_match[low].match
+               : -1;
+}
+
+void tokenizer_fingerprint(TokenizerContext *context, const bool enabled) {
+    context->fingerprinting = enabled;
+    context->fingerprint[0] = FINGERPRINT_SEED_1;
+    context->fingerprint[1] = FINGERPRINT_SEED_2;
+}
+
+void tokenizer_fingerprint_digest(const TokenizerContext *context, uint64_t digest[2]) {
+    const uint64_t first = fingerprint_finish(context->fingerprint[0]);
+    const uint64_t second = fingerprint_finish(context->fingerprint[1] ^ first);
+
+    digest[0] = first;
+    digest[1] = second;
+}
+
+bool tokenizer_compute_fingerprint(TokenizerContext *context, uint64_t digest[2]) {
+    if (!context->fingerprinting) {
+        tokenizer_fingerprint(context, true);
+    }
+
+    TokenType type;
+    while (scan(context, &type)) {
+    }
+
+    tokenizer_fingerprint_digest(context, digest);
+    return !error.message;
+}
+
+const Token *tokenizer_peek(TokenizerContext *context, const int k) {
+    if (k < 0 || k >= TOKENIZER_LOOKAHEAD) {
+        return NULL;
+    }
+
+    if (k >= context->lookahead_count) {
+        fill_lookahead(context);
+
+        if (k >= context->lookahead_count) {
+            return NULL;
+        }
+    }
+
+    return &context->lookahead[(context->lookahead_start + k) % TOKENIZER_LOOKAHEAD].token;
+}
+
+const Token *tokenizer_advance(TokenizerContext *context) {
+    if (!tokenizer_peek(context, 0)) {
+        return NULL;
+    }
+
+    const TokenizerSlot consumed = context->lookahead[context->lookahead_start];
+    context->lookahead[context->lookahead_start] = context->current;
+    context->current = consumed;
+
+    context->lookahead_start = (context->lookahead_start + 1) % TOKENIZER_LOOKAHEAD;
+    context->lookahead_count--;
+    return &context->current.token;
+}
+
+const TokenExtras *tokenizer_token_extras(const TokenizerContext *context) {
+    return &context->current.extras;
+}
+
 TokenizerContext *tokenizer_init(const char *filename) {
     FILE *bin_file = fopen(filename, "rb");
     if (!bin_file) {
@@ -548,7 +1166,7 @@ TokenizerContext *tokenizer_init(const char *filename) {
         return NULL;
     }
 
-    TokenizerContext *context = malloc(sizeof(TokenizerContext));
+    TokenizerContext *context = calloc(1, sizeof(TokenizerContext));
     if (!context) {
         fclose(text_file);
         return NULL;
@@ -561,7 +1179,7 @@ TokenizerContext *tokenizer_init(const char *filename) {
         return NULL;
     }
 
-    const int read_bytes = (int) fread(content, 1, content_length, text_file);
+    const size_t read_bytes = fread(content, 1, content_length, text_file);
     if (ferror(text_file)) {
         free(content);
         free(context);
@@ -574,6 +1192,7 @@ TokenizerContext *tokenizer_init(const char *filename) {
 
     context->content = content;
     context->content_length = read_bytes;
+    context->owns_content = true;
     context->line = 1;
     context->column = 1;
     context->offset = 0;
@@ -581,15 +1200,235 @@ TokenizerContext *tokenizer_init(const char *filename) {
     return context;
 }
 
+TokenizerContext *tokenizer_init_string(const char *content, const long long length) {
+    TokenizerContext *context = calloc(1, sizeof(TokenizerContext));
+    if (!context) {
+        return NULL;
+    }
+
+    context->content = malloc(length + 1);
+    if (!context->content) {
+        free(context);
+        return NULL;
+    }
+
+    memcpy(context->content, content, length);
+    context->content[length] = '\0';
+    context->content_length = length;
+    context->owns_content = true;
+    context->line = 1;
+    context->column = 1;
+    context->offset = 0;
+
+    return context;
+}
+
+void tokenizer_reset(TokenizerContext *context, const char *content, const long long length) {
+    if (context->owns_content) {
+        free(context->content);
+    }
+
+    context->content = (char *) content;
+    context->content_length = length;
+    context->owns_content = false;
+
+    // Same starting state as a freshly allocated context.
+    context->frame = (TokenizerFrame) {0, 1, 1};
+    context->type = LEFT_PARENT;
+    context->offset = 0;
+    context->line = 1;
+    context->column = 1;
+
+    context->lookahead_start = 0;
+    context->lookahead_count = 0;
+    context->errors_count = 0;
+    context->checkpoints_count = 0;
+    context->checkpoint_next = 0;
+    context->trivia_count = 0;
+    context->leading = (TriviaSpan) {0, 0};
+    context->trailing = (TriviaSpan) {0, 0};
+    context->trailing_end = 0;
+    context->fingerprint[0] = FINGERPRINT_SEED_1;
+    context->fingerprint[1] = FINGERPRINT_SEED_2;
+    context->token_index = 0;
+    context->bracket_stack_count = 0;
+    context->bracket_match_count = 0;
+
+    error.message = NULL;
+}
+
 void tokenizer_free(TokenizerContext *tokenizer) {
     if (!tokenizer) {
         return;
     }
 
-    free(tokenizer->content);
+    for (int i = 0; i < TOKENIZER_LOOKAHEAD; i++) {
+        free(tokenizer->lookahead[i].token.content);
+    }
+    free(tokenizer->current.token.content);
+
+    free(tokenizer->errors);
+    free(tokenizer->checkpoints);
+    free(tokenizer->trivia);
+    free(tokenizer->bracket_stack);
+    free(tokenizer->bracket_match);
+    if (tokenizer->owns_content) {
+        free(tokenizer->content);
+    }
     free(tokenizer);
 }
 
+TokenizerCheckpoint tokenizer_checkpoint(const TokenizerContext *context) {
+    if (context->lookahead_count > 0) {
+        return context->lookahead[context->lookahead_start].start;
+    }
+
+    return collect_checkpoint(context);
+}
+
+void tokenizer_restore(TokenizerContext *context, const TokenizerCheckpoint *checkpoint) {
+    context->offset = checkpoint->offset;
+    context->line = checkpoint->line;
+    context->column = checkpoint->column;
+    context->type = checkpoint->type;
+    context->trailing_end = checkpoint->offset;
+    context->lookahead_start = 0;
+    context->lookahead_count = 0;
+    context->token_index = 0;
+    context->bracket_stack_count = 0;
+    context->bracket_match_count = 0;
+    error.message = NULL;
+
+    if (context->checkpoint_interval) {
+        context->checkpoint_next = (context->offset / context->checkpoint_interval + 1) * context->checkpoint_interval;
+    }
+}
+
+void tokenizer_record_checkpoints(TokenizerContext *context, const long long interval) {
+    context->checkpoint_interval = interval > 0 ? interval : 0;
+    context->checkpoint_next = context->offset;
+}
+
+const TokenizerCheckpoint *tokenizer_find_checkpoint(const TokenizerCheckpoint *checkpoints, const int count,
+                                                     const long long offset) {
+    int low = 0;
+    int high = count - 1;
+    const TokenizerCheckpoint *found = NULL;
+
+    while (low <= high) {
+        const int middle = low + (high - low) / 2;
+
+        if (checkpoints[middle].offset <= offset) {
+            found = &checkpoints[middle];
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return found;
+}
+
+bool tokenizer_write_checkpoints(FILE *file, const TokenizerCheckpoint *checkpoints, const int count) {
+    unsigned char header[12];
+    memcpy(header, CHECKPOINT_MAGIC, 4);
+    write_u32(header + 4, CHECKPOINT_VERSION);
+    write_u32(header + 8, count);
+
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        unsigned char record[CHECKPOINT_RECORD_SIZE];
+        write_u64(record, checkpoints[i].offset);
+        write_u64(record + 8, checkpoints[i].line);
+        write_u64(record + 16, checkpoints[i].column);
+        write_u32(record + 24, checkpoints[i].type);
+
+        if (fwrite(record, 1, sizeof(record), file) != sizeof(record)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TokenizerCheckpoint *tokenizer_read_checkpoints(FILE *file, int *count) {
+    unsigned char header[12];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)
+        || memcmp(header, CHECKPOINT_MAGIC, 4) != 0
+        || read_u32(header + 4) != CHECKPOINT_VERSION) {
+        return NULL;
+    }
+
+    // The count comes from the file: it has to fit an int and, for regular files, the
+    // records actually left in it. Streams of unknown size grow the array as records
+    // arrive instead of trusting it up front.
+    const uint32_t length = read_u32(header + 8);
+    if (length > INT_MAX) {
+        return NULL;
+    }
+
+    struct stat info;
+    const long position = ftell(file);
+    uint32_t capacity = length < 1024 ? length : 1024;
+    if (position >= 0 && fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode)) {
+        const uint64_t remaining = info.st_size > position ? (uint64_t) (info.st_size - position) : 0;
+        if ((uint64_t) length * CHECKPOINT_RECORD_SIZE > remaining) {
+            return NULL;
+        }
+        capacity = length;
+    }
+
+    TokenizerCheckpoint *checkpoints = malloc((capacity ? capacity : 1) * sizeof(TokenizerCheckpoint));
+    if (!checkpoints) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < length; i++) {
+        if (i == capacity) {
+            capacity = capacity > length / 2 ? length : capacity * 2;
+            TokenizerCheckpoint *grown = realloc(checkpoints, capacity * sizeof(TokenizerCheckpoint));
+            if (!grown) {
+                free(checkpoints);
+                return NULL;
+            }
+            checkpoints = grown;
+        }
+
+        unsigned char record[CHECKPOINT_RECORD_SIZE];
+        if (fread(record, 1, sizeof(record), file) != sizeof(record)) {
+            free(checkpoints);
+            return NULL;
+        }
+
+        const uint32_t type = read_u32(record + 24);
+        if (type >= TOKEN_TYPE_COUNT) {
+            free(checkpoints);
+            return NULL;
+        }
+
+        checkpoints[i].offset = (long long) read_u64(record);
+        checkpoints[i].line = (long long) read_u64(record + 8);
+        checkpoints[i].column = (long long) read_u64(record + 16);
+        checkpoints[i].type = (TokenType) type;
+    }
+
+    *count = (int) length;
+    return checkpoints;
+}
+
+const char* trivia_kind_to_string(const TriviaKind kind) {
+    switch (kind) {
+        case TRIVIA_WHITESPACE: return "WHITESPACE";
+        case TRIVIA_NEWLINE: return "NEWLINE";
+        case TRIVIA_LINE_COMMENT: return "LINE_COMMENT";
+        case TRIVIA_BLOCK_COMMENT: return "BLOCK_COMMENT";
+        default: return "UNKNOWN_TRIVIA";
+    }
+}
+
 const char* token_type_to_string(const TokenType type) {
     switch (type) {
         case LEFT_PARENT: return "LEFT_PARENT";
@@ -689,6 +1528,17 @@ const char* token_type_to_string(const TokenType type) {
     }
 }
 
+bool token_type_from_string(const char *name, TokenType *type) {
+    for (int i = 0; i < TOKEN_TYPE_COUNT; i++) {
+        if (strcmp(token_type_to_string(i), name) == 0) {
+            *type = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 char* token_content_to_value(const Token *token) {
     const char *content = token->content;
     switch (token->type) {
@@ -1,6 +1,10 @@
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
 typedef enum {
     LEFT_PARENT,
     RIGHT_PARENT,
@@ -96,8 +100,12 @@ typedef enum {
     ERROR
 } TokenType;
 
+#define TOKEN_TYPE_COUNT (ERROR + 1)
+
 const char* token_type_to_string(TokenType type);
 
+bool token_type_from_string(const char *name, TokenType *type);
+
 typedef struct {
     const char *keyword;
     TokenType token;
@@ -128,44 +136,210 @@ static const KeywordEntry keywords[] = {
     {"as", AS},
 };
 
+typedef enum {
+    TRIVIA_WHITESPACE,
+    TRIVIA_NEWLINE,
+    TRIVIA_LINE_COMMENT,
+    TRIVIA_BLOCK_COMMENT
+} TriviaKind;
+
+const char* trivia_kind_to_string(TriviaKind kind);
+
+typedef struct {
+    TriviaKind kind;
+    long long offset;
+    long long length;
+} Trivia;
+
+// Range of entries in context->trivia.
+typedef struct {
+    long long first;
+    long long count;
+} TriviaSpan;
+
 typedef struct {
     TokenType type;
     char *content;
-    int offset;
-    int length;
-    int line;
-    int column;
+    long long offset;
+    long long length;
+    long long line;
+    long long column;
 } Token;
 
+// Trivia around a token and its position in the token stream. Kept next to the token
+// rather than in it and only filled while trivia or bracket mode is on.
+typedef struct {
+    TriviaSpan leading;
+    TriviaSpan trailing;
+    long long index;
+} TokenExtras;
+
 char* token_content_to_value(const Token *token);
 
 typedef struct {
-    int offset;
-    int line;
-    int column;
+    long long offset;
+    long long line;
+    long long column;
 } TokenizerFrame;
 
 typedef struct {
-    char *content;
-    int content_length;
+    char *message;
     TokenizerFrame frame;
+} TokenizerError;
+
+typedef struct {
+    long long offset;
+    long long line;
+    long long column;
     TokenType type;
-    int offset;
-    int line;
-    int column;
-} TokenizerContext;
+} TokenizerCheckpoint;
 
+// An open bracket waiting for its partner; `match` is its entry in context->bracket_match.
 typedef struct {
-    char *message;
+    long long match;
+    TokenType type;
     TokenizerFrame frame;
-} TokenizerError;
+} TokenizerBracket;
+
+// One entry per bracket token, in token order; `match` is the partner's token index or -1.
+typedef struct {
+    long long index;
+    long long match;
+} TokenizerBracketMatch;
+
+#define TOKENIZER_LOOKAHEAD 8
+
+typedef struct {
+    Token token;
+    TokenExtras extras;
+    long long capacity;
+    TokenizerCheckpoint start;
+} TokenizerSlot;
 
-extern TokenizerError error;
+typedef struct {
+    char *content;
+    long long content_length;
+    bool owns_content;
+    TokenizerFrame frame;
+    TokenType type;
+    long long offset;
+    long long line;
+    long long column;
+    TokenizerSlot lookahead[TOKENIZER_LOOKAHEAD];
+    TokenizerSlot current;
+    int lookahead_start;
+    int lookahead_count;
+    bool recover;
+    TokenizerError *errors;
+    int errors_count;
+    int errors_capacity;
+    long long checkpoint_interval;
+    long long checkpoint_next;
+    TokenizerCheckpoint *checkpoints;
+    int checkpoints_count;
+    int checkpoints_capacity;
+    bool filtered;
+    unsigned char filter[(TOKEN_TYPE_COUNT + 7) / 8];
+    bool trivia_mode;
+    Trivia *trivia;
+    long long trivia_count;
+    long long trivia_capacity;
+    TriviaSpan leading;
+    TriviaSpan trailing;
+    long long trailing_end;
+    bool fingerprinting;
+    uint64_t fingerprint[2];
+    long long token_index;
+    bool brackets_mode;
+    TokenizerBracket *bracket_stack;
+    long long bracket_stack_count;
+    long long bracket_stack_capacity;
+    TokenizerBracketMatch *bracket_match;
+    long long bracket_match_count;
+    long long bracket_match_capacity;
+} TokenizerContext;
+
+extern _Thread_local TokenizerError error;
 
 TokenizerContext *tokenizer_init(const char *filename);
 
+// Creates a context over a copy of the given source text.
+TokenizerContext *tokenizer_init_string(const char *content, long long length);
+
+// Points the context at a new source without allocating. The buffer is borrowed: it
+// must stay valid until the next reset or tokenizer_free, and needs no terminator.
+// Position, lookahead, diagnostics, trivia, checkpoints, fingerprint, bracket state and
+// the thread's `error` are cleared; enabled modes and the filter are kept, as is every
+// buffer's capacity.
+void tokenizer_reset(TokenizerContext *context, const char *content, long long length);
+
 void tokenizer_free(TokenizerContext *tokenizer);
 
 Token *tokenizer_next(TokenizerContext *context);
 
+// Advances past the next token without materializing it. On success the token spans
+// context->frame.offset up to context->offset. Must not be mixed with pending lookahead.
+bool tokenizer_scan(TokenizerContext *context, TokenType *type);
+
+// In recovery mode malformed input produces ERROR tokens instead of stopping the lexer,
+// and every diagnostic is collected in context->errors rather than the global error.
+void tokenizer_recover(TokenizerContext *context, bool recover);
+
+// Restricts the produced tokens to the given types (ERROR is always produced).
+// Other tokens are scanned past without being materialized. A count of 0 removes the filter.
+void tokenizer_filter(TokenizerContext *context, const TokenType *types, int count);
+
+// Records whitespace and comments around every token as ranges into the source
+// (context->trivia). Leading trivia ends at the token, trailing trivia runs up to
+// and including the end of the token's line.
+void tokenizer_trivia(TokenizerContext *context, bool enabled);
+
+// Matches (), {} and [] while lexing, recording only bracket tokens. In recovery mode
+// mismatches are added to context->errors without stopping the lexer. Token indexes
+// count every scanned token, including filtered ones.
+void tokenizer_brackets(TokenizerContext *context, bool enabled);
+
+// Returns the index of the token closing (or opening) the bracket at token_index, or -1.
+// A binary search over the bracket tokens.
+long long tokenizer_bracket_match(const TokenizerContext *context, long long token_index);
+
+// Streams a 128-bit fingerprint over token types and texts (trivia is ignored) while lexing.
+void tokenizer_fingerprint(TokenizerContext *context, bool enabled);
+
+void tokenizer_fingerprint_digest(const TokenizerContext *context, uint64_t digest[2]);
+
+// Scans the remaining input without materializing tokens and returns its fingerprint.
+bool tokenizer_compute_fingerprint(TokenizerContext *context, uint64_t digest[2]);
+
+// Returns the k-th upcoming token (0-based, k < TOKENIZER_LOOKAHEAD) without consuming it,
+// or NULL past the end of input. The token is owned by the context.
+const Token *tokenizer_peek(TokenizerContext *context, int k);
+
+// Consumes the upcoming token. The returned token is owned by the context
+// and stays valid until the next call to tokenizer_advance.
+const Token *tokenizer_advance(TokenizerContext *context);
+
+// Trivia spans and index of the token last returned by tokenizer_next or
+// tokenizer_advance. Only filled while trivia or bracket mode is on.
+const TokenExtras *tokenizer_token_extras(const TokenizerContext *context);
+
+// Captures the lexer state in front of the next token that would be returned.
+TokenizerCheckpoint tokenizer_checkpoint(const TokenizerContext *context);
+
+// Resumes lexing from a checkpoint taken on the same content. Pending lookahead and the
+// thread's `error` are discarded, and token indexes and bracket matching start over
+// from the checkpoint.
+void tokenizer_restore(TokenizerContext *context, const TokenizerCheckpoint *checkpoint);
+
+// Records a checkpoint into context->checkpoints every `interval` bytes while lexing (0 disables).
+void tokenizer_record_checkpoints(TokenizerContext *context, long long interval);
+
+// Returns the checkpoint nearest at or before offset, or NULL if there is none.
+const TokenizerCheckpoint *tokenizer_find_checkpoint(const TokenizerCheckpoint *checkpoints, int count,
+                                                     long long offset);
+
+bool tokenizer_write_checkpoints(FILE *file, const TokenizerCheckpoint *checkpoints, int count);
+
+TokenizerCheckpoint *tokenizer_read_checkpoints(FILE *file, int *count);
+
 #endif //TOKENIZER_H
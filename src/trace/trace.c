@@ -0,0 +1,210 @@
+#include "trace.h"
+
+#include <json_writer.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_CHUNK_EVENTS 4096
+#define TRACE_CHUNK_NAME_BYTES 65536
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    const char *file;
+    TracePhase phase;
+} TraceEvent;
+
+// Events point at file names copied into `names`, so callers' buffers may go away
+// before the trace is written at exit.
+typedef struct TraceChunk {
+    struct TraceChunk *next;
+    int count;
+    size_t names_used;
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+    char names[TRACE_CHUNK_NAME_BYTES];
+} TraceChunk;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;
+    int thread;
+    TraceChunk *first;
+    TraceChunk *last;
+    const char *last_name;
+} TraceBuffer;
+
+static const char *trace_file;
+static uint64_t trace_origin;
+static _Atomic(TraceBuffer *) trace_buffers;
+static atomic_int trace_threads;
+static _Thread_local TraceBuffer *trace_buffer;
+
+static const char *phase_names[] = {
+    "file",
+    "read",
+    "lex",
+    "decode",
+    "serialize",
+    "write"
+};
+
+static uint64_t clock_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+// Buffers are pushed onto a global lock-free list the first time a thread records a
+// span and are only walked once every worker has been joined.
+static TraceBuffer *thread_buffer(void) {
+    if (trace_buffer) {
+        return trace_buffer;
+    }
+
+    TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+    TraceChunk *chunk = calloc(1, sizeof(TraceChunk));
+    if (!buffer || !chunk) {
+        free(buffer);
+        free(chunk);
+        return NULL;
+    }
+
+    buffer->thread = atomic_fetch_add(&trace_threads, 1);
+    buffer->first = chunk;
+    buffer->last = chunk;
+
+    buffer->next = atomic_load(&trace_buffers);
+    while (!atomic_compare_exchange_weak(&trace_buffers, &buffer->next, buffer)) {
+    }
+
+    trace_buffer = buffer;
+    return buffer;
+}
+
+static double microseconds(const uint64_t nanoseconds) {
+    return (double) nanoseconds / 1000.0;
+}
+
+static void trace_flush(void) {
+    JsonWriter *jw = jw_open(trace_file);
+    if (!jw) {
+        fprintf(stderr, "Failed to open trace file\n");
+        return;
+    }
+
+    const int pid = (int) getpid();
+
+    jw_style_compact(jw);
+    jw_stype_precision_double(jw, 3);
+    jw_object_start(jw);
+    {
+        jw_key(jw, "traceEvents");
+        jw_array_start(jw);
+        for (TraceBuffer *buffer = atomic_load(&trace_buffers); buffer; buffer = buffer->next) {
+            char name[32] = "main";
+            if (buffer->thread > 0) {
+                snprintf(name, sizeof(name), "worker %d", buffer->thread);
+            }
+
+            jw_object_start(jw);
+            {
+                jw_key(jw, "name"); jw_string(jw, "thread_name");
+                jw_key(jw, "ph"); jw_string(jw, "M");
+                jw_key(jw, "pid"); jw_integer(jw, pid);
+                jw_key(jw, "tid"); jw_integer(jw, buffer->thread);
+                jw_key(jw, "args");
+                jw_object_start(jw);
+                jw_key(jw, "name"); jw_string(jw, name);
+                jw_object_end(jw);
+            }
+            jw_object_end(jw);
+
+            for (const TraceChunk *chunk = buffer->first; chunk; chunk = chunk->next) {
+                for (int i = 0; i < chunk->count; i++) {
+                    const TraceEvent *event = &chunk->events[i];
+                    jw_object_start(jw);
+                    {
+                        jw_key(jw, "name");
+                        jw_string(jw, event->phase == TRACE_FILE && event->file ? event->file : phase_names[event->phase]);
+                        jw_key(jw, "cat"); jw_string(jw, phase_names[event->phase]);
+                        jw_key(jw, "ph"); jw_string(jw, "X");
+                        jw_key(jw, "ts"); jw_double(jw, microseconds(event->start - trace_origin));
+                        jw_key(jw, "dur"); jw_double(jw, microseconds(event->end - event->start));
+                        jw_key(jw, "pid"); jw_integer(jw, pid);
+                        jw_key(jw, "tid"); jw_integer(jw, buffer->thread);
+                        if (event->file) {
+                            jw_key(jw, "args");
+                            jw_object_start(jw);
+                            jw_key(jw, "file"); jw_string(jw, event->file);
+                            jw_object_end(jw);
+                        }
+                    }
+                    jw_object_end(jw);
+                }
+            }
+        }
+        jw_array_end(jw);
+
+        jw_key(jw, "displayTimeUnit"); jw_string(jw, "ns");
+    }
+    jw_object_end(jw);
+    jw_close(jw);
+}
+
+bool trace_start(const char *filename) {
+    trace_file = filename;
+    trace_origin = clock_ns();
+
+    // Claim thread 0 for the caller so the main thread is always named first.
+    return thread_buffer() && atexit(trace_flush) == 0;
+}
+
+uint64_t trace_now(void) {
+    return trace_file ? clock_ns() : 0;
+}
+
+void trace_span(const TracePhase phase, const char *file, const uint64_t start) {
+    if (!trace_file) {
+        return;
+    }
+
+    const uint64_t end = clock_ns();
+    TraceBuffer *buffer = thread_buffer();
+    if (!buffer) {
+        return;
+    }
+
+    // The phases of one file follow each other, so its name is usually copied once.
+    const char *name = file && buffer->last_name && strcmp(buffer->last_name, file) == 0 ? buffer->last_name : NULL;
+    size_t length = 0;
+    if (file && !name) {
+        length = strlen(file) + 1;
+        if (length > TRACE_CHUNK_NAME_BYTES) {
+            length = TRACE_CHUNK_NAME_BYTES;
+        }
+    }
+
+    if (buffer->last->count == TRACE_CHUNK_EVENTS || buffer->last->names_used + length > TRACE_CHUNK_NAME_BYTES) {
+        TraceChunk *chunk = calloc(1, sizeof(TraceChunk));
+        if (!chunk) {
+            return;
+        }
+
+        buffer->last->next = chunk;
+        buffer->last = chunk;
+    }
+
+    TraceChunk *chunk = buffer->last;
+    if (length) {
+        char *copy = chunk->names + chunk->names_used;
+        memcpy(copy, file, length - 1);
+        copy[length - 1] = '\0';
+        chunk->names_used += length;
+        buffer->last_name = name = copy;
+    }
+
+    chunk->events[chunk->count++] = (TraceEvent) {start, end, name, phase};
+}
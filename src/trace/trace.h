@@ -0,0 +1,27 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    TRACE_FILE,
+    TRACE_READ,
+    TRACE_LEX,
+    TRACE_DECODE,
+    TRACE_SERIALIZE,
+    TRACE_WRITE
+} TracePhase;
+
+// Enables tracing and writes the collected spans to `filename` as Chrome trace-event
+// JSON when the process exits. Call before starting any worker threads.
+bool trace_start(const char *filename);
+
+// Returns a timestamp in nanoseconds, or 0 when tracing is disabled.
+uint64_t trace_now(void);
+
+// Records a span from `start` until now on the calling thread. Each thread appends to
+// its own buffer, so no locks are taken. `file` is copied and may be freed afterwards.
+void trace_span(TracePhase phase, const char *file, uint64_t start);
+
+#endif //TRACE_H
@@ -0,0 +1,123 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/shm/token_ring.h"
+
+// Reference consumer for `lexer_cli --shm`: attaches to the ring, walks the records
+// in place and reports throughput. With --print each token is resolved against the
+// source file the producer advertised in the ring header.
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static const char *map_source(const char *path, off_t *length) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    const char *content = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (content == MAP_FAILED) {
+        return NULL;
+    }
+
+    *length = info.st_size;
+    return content;
+}
+
+int main(const int argc, char **argv) {
+    const char *name = NULL;
+    bool print = false;
+    int timeout = 5000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--print") == 0) {
+            print = true;
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            timeout = atoi(argv[++i]);
+        } else {
+            name = argv[i];
+        }
+    }
+
+    if (!name) {
+        fprintf(stderr, "usage: shm_consumer /name [--print] [--timeout ms]\n");
+        return 1;
+    }
+
+    TokenRing *ring = token_ring_open(name, timeout);
+    if (!ring) {
+        fprintf(stderr, "Failed to attach to shared memory ring '%s'\n", name);
+        return 1;
+    }
+
+    // The mapping stays valid after the name is gone; unlinking now means a crashed
+    // producer cannot leave the segment behind.
+    token_ring_unlink(name);
+
+    off_t source_length = 0;
+    const char *source = NULL;
+    if (print) {
+        source = map_source(ring->header->source, &source_length);
+        if (!source) {
+            fprintf(stderr, "Failed to map source file '%s'\n", ring->header->source);
+        }
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    unsigned long long tokens = 0;
+    unsigned long long bytes = 0;
+    const CompactToken *records;
+    uint32_t count;
+
+    while ((count = token_ring_acquire(ring, &records)) > 0) {
+        for (uint32_t i = 0; i < count; i++) {
+            const CompactToken *token = &records[i];
+            const long long offset = compact_token_offset(token);
+            const long long length = compact_token_length(token);
+
+            bytes += length;
+
+            if (print) {
+                printf("%s %lld %lld", token_type_to_string(compact_token_type(token)), offset, length);
+                if (source && offset + length <= source_length) {
+                    printf(" %.*s", (int) length, source + offset);
+                }
+                printf("\n");
+            }
+        }
+
+        tokens += count;
+        token_ring_release(ring, count);
+    }
+
+    const double elapsed = seconds_since(&start);
+    const TokenRingState state = token_ring_state(ring);
+
+    fprintf(stderr, "%llu tokens, %llu bytes in %.3fs (%.0f tokens/s)%s\n", tokens, bytes, elapsed,
+            elapsed > 0 ? (double) tokens / elapsed : 0.0, state == TOKEN_RING_FAILED ? ", producer failed" : "");
+
+    if (source) {
+        munmap((void *) source, source_length);
+    }
+    token_ring_close(ring);
+    return state == TOKEN_RING_FAILED ? 1 : 0;
+}
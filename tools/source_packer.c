@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/io/source_pack.h"
+
+// Builds a pack for `lexer_cli --pack` from the files on the command line, or from
+// stdin one path per line when the only file given is "-" (for trees too large for
+// argv). --list prints the entries of an existing pack.
+
+static char **read_paths(int *count) {
+    char **paths = NULL;
+    int capacity = 0;
+    char line[4096];
+
+    *count = 0;
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            char **grown = realloc(paths, capacity * sizeof(char *));
+            if (!grown) {
+                break;
+            }
+            paths = grown;
+        }
+        paths[(*count)++] = strdup(line);
+    }
+
+    return paths;
+}
+
+static int list_pack(const char *filename) {
+    SourcePack *pack = source_pack_open(filename);
+    if (!pack) {
+        fprintf(stderr, "Failed to open pack file\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < pack->count; i++) {
+        SourcePackEntry entry;
+        if (!source_pack_entry(pack, i, &entry)) {
+            fprintf(stderr, "Entry %u is corrupt\n", i);
+            source_pack_close(pack);
+            return 1;
+        }
+        printf("%10lld  %s\n", entry.length, entry.path);
+    }
+
+    source_pack_close(pack);
+    return 0;
+}
+
+int main(const int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "--list") == 0) {
+        return list_pack(argv[2]);
+    }
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: source_packer <pack> <files...|->\n"
+                "       source_packer --list <pack>\n");
+        return 1;
+    }
+
+    char **paths = argv + 2;
+    int count = argc - 2;
+    const bool from_stdin = count == 1 && strcmp(paths[0], "-") == 0;
+    if (from_stdin) {
+        paths = read_paths(&count);
+    }
+
+    const bool written = source_pack_write(argv[1], paths, count);
+    if (!written) {
+        fprintf(stderr, "Failed to write pack file\n");
+    }
+
+    if (from_stdin) {
+        for (int i = 0; i < count; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+    }
+
+    return written ? 0 : 1;
+}